@@ -0,0 +1,244 @@
+#!/bin/bash
+
+# Benchmarks of the compiler, run as `./bench.sh <name>...`, or all of them without names.
+
+repeat() {
+    head -c "$2" /dev/zero | tr '\0' "$1"
+}
+
+# Sum of `terms` random products of the variables a-j, which keeps about ten values live.
+products() {
+    terms="$1"
+    for v in a b c d e f g h i j; do
+        echo -n "$v=$((RANDOM % 9 + 1)); "
+    done
+    echo -n "return 0"
+    vars=(a b c d e f g h i j)
+    for ((t = 0; t < terms; t++)); do
+        echo -n "+${vars[RANDOM % 10]}*${vars[RANDOM % 10]}"
+    done
+    echo ";"
+}
+
+# `width` values computed before any is added, so that all of them are live at once.
+nested() {
+    width="$1"
+    echo -n "a=1; return "
+    for ((i = 0; i < width; i++)); do
+        echo -n "(a+$i)+("
+    done
+    echo -n a
+    repeat ")" "$width"
+    echo ";"
+}
+
+# Reassignments of a few variables, with little pressure.
+chain() {
+    length="$1"
+    echo -n "a=1; b=2; c=3; "
+    for ((i = 0; i < length; i++)); do
+        echo -n "a=a+b*$i; b=b-c; c=c*a-$i; "
+    done
+    echo "return a+b+c;"
+}
+
+# Compile time against code quality of the register allocators, on the programs in temp.in.
+measure_regalloc() {
+    name="$1"
+    runs="$2"
+    for opt in -O1 -O2; do
+        start=$(date +%s%N)
+        for ((r = 0; r < runs; r++)); do
+            ./9cc $opt -fno-const-prop - < temp.in > temp.s || exit 1
+        done
+        end=$(date +%s%N)
+        ./9cc $opt -fno-const-prop --stats - < temp.in > temp.s 2> temp.err
+        spilled=$(grep "^regalloc:" temp.err | cut -d " " -f 3)
+        insns=$(grep -c "^  " temp.s)
+        memory=$(grep -c "qword ptr \[rbp-" temp.s)
+        printf "%-14s %-4s %8d us %8d spilled %8d insns %8d spill accesses\n" "$name" "$opt" \
+            $(((end - start) / runs / 1000)) "$spilled" "$insns" "$memory"
+    done
+}
+
+bench_regalloc() {
+    echo "linear scan (-O1) against graph coloring (-O2), per compile"
+    RANDOM=40
+    chain 200 > temp.in
+    measure_regalloc "chain 200" 20
+    products 50 > temp.in
+    measure_regalloc "products 50" 20
+    products 500 > temp.in
+    measure_regalloc "products 500" 20
+    nested 100 > temp.in
+    measure_regalloc "nested 100" 20
+    nested 1000 > temp.in
+    measure_regalloc "nested 1000" 3
+}
+
+# Full binary tree of `depth` levels over the variables a-g, which needs depth + 1 registers.
+balanced() {
+    echo -n "a=1; b=2; c=3; d=4; e=5; f=6; g=7; return "
+    leaves=(a b c d e f g)
+    ops=(- + "*" -)
+    leaf=0
+    op=0
+    tree "$1"
+    echo ";"
+}
+
+tree() {
+    if [ "$1" = 0 ]; then
+        echo -n "${leaves[leaf++ % 7]}"
+        return
+    fi
+    echo -n "("
+    tree $(($1 - 1))
+    echo -n "${ops[op++ % 4]}"
+    tree $(($1 - 1))
+    echo -n ")"
+}
+
+# Cycles per run of the program in temp.in compiled with each option set, timing `main` as a
+# function called in a loop by a C driver, with the best of several rounds.
+measure_cycles() {
+    name="$1"
+    shift
+    dir=$(mktemp -d)
+    cat > "$dir/driver.c" << EOF
+#include <stdio.h>
+#include <stdlib.h>
+#include <x86intrin.h>
+
+long kernel(void);
+
+int main(int argc, char** argv) {
+    int runs = atoi(argv[1]);
+    unsigned long long best = -1;
+    for (int round = 0; round < 20; round++) {
+        unsigned long long start = __rdtsc();
+        for (int i = 0; i < runs; i++) {
+            kernel();
+        }
+        unsigned long long cycles = __rdtsc() - start;
+        best = cycles < best ? cycles : best;
+    }
+    printf("%.1f\n", (double)best / runs);
+    return 0;
+}
+EOF
+    for opts in "$@"; do
+        ./9cc ${opts//,/ } - < temp.in | sed "s/\bmain\b/kernel/" > "$dir/kernel.s" || exit 1
+        cc -O2 -o "$dir/bench" "$dir/driver.c" "$dir/kernel.s" 2> /dev/null || exit 1
+        insns=$(grep -c "^  " "$dir/kernel.s")
+        memory=$(grep -cE "push|pop|\[" "$dir/kernel.s")
+        printf "%-14s %-20s %10s cycles %8d insns %8d memory accesses\n" "$name" "$opts" \
+            "$("$dir/bench" 1000)" "$insns" "$memory"
+    done
+    rm -r "$dir"
+}
+
+bench_exprs() {
+    echo "stack machine (-O0 -fstack-machine) against registers (-O0), per run of main"
+    RANDOM=41
+    chain 200 > temp.in
+    measure_cycles "chain 200" -O0,-fstack-machine -O0
+    products 500 > temp.in
+    measure_cycles "products 500" -O0,-fstack-machine -O0
+    balanced 4 > temp.in
+    measure_cycles "balanced 4" -O0,-fstack-machine -O0
+    balanced 10 > temp.in
+    measure_cycles "balanced 10" -O0,-fstack-machine -O0
+}
+
+# Wall time per program of each way to get the result of temp.in, from source to exit status.
+measure_pipelines() {
+    name="$1"
+    runs="$2"
+    for pipeline in "cc" "--exe" "--run"; do
+        start=$(date +%s%N)
+        for ((r = 0; r < runs; r++)); do
+            case "$pipeline" in
+            cc) ./9cc - < temp.in > temp.s && cc -o temp temp.s 2> /dev/null && ./temp ;;
+            --exe) ./9cc --exe -o temp - < temp.in && ./temp ;;
+            --run) ./9cc --run - < temp.in ;;
+            esac
+        done
+        end=$(date +%s%N)
+        printf "%-14s %-6s %8d us\n" "$name" "$pipeline" $(((end - start) / runs / 1000))
+    done
+}
+
+bench_run() {
+    echo "assembling and linking with cc against --exe and --run, per program"
+    RANDOM=42
+    chain 20 > temp.in
+    measure_pipelines "chain 20" 50
+    products 500 > temp.in
+    measure_pipelines "products 500" 50
+}
+
+# Time per bytecode op of each interpreter dispatch on temp.in, and the overhead per op against
+# the -O0 code, which runs about one instruction per node like the bytecode, called by --run.
+measure_dispatch() {
+    name="$1"
+    ./9cc -O0 --stats --run - < temp.in 2>&1 > /dev/null | grep "^run:" > temp.err
+    native=$(cut -d " " -f 2 temp.err)
+    for interp in --interp --interp=switch; do
+        ./9cc -O0 --stats $interp - < temp.in 2>&1 > /dev/null | grep "^interp:" > temp.err
+        ops=$(cut -d " " -f 2 temp.err)
+        ns=$(cut -d " " -f 4 temp.err)
+        awk -v name="$name" -v interp="$interp" -v ops="$ops" -v ns="$ns" -v native="$native" \
+            'BEGIN { printf "%-14s %-16s %6d ops %6.2f ns per op %6.2f native %6.2f overhead\n",
+                name, interp, ops, ns / ops, native / ops, (ns - native) / ops }'
+    done
+}
+
+bench_interp() {
+    echo "threaded (--interp) against switch (--interp=switch) dispatch, against -O0 code"
+    RANDOM=43
+    chain 200 > temp.in
+    measure_dispatch "chain 200"
+    products 500 > temp.in
+    measure_dispatch "products 500"
+    balanced 10 > temp.in
+    measure_dispatch "balanced 10"
+}
+
+# Wall time per version of an editor session on temp.in, whose versions each edit the statement
+# `c=c*a-<middle>;` of chain, against compiling each version whole.
+measure_incremental() {
+    name="$1"
+    middle="$2"
+    versions="$3"
+    for ((v = 0; v < versions; v++)); do
+        sed "s/ c=c\*a-$middle; / c=c*a-$v; /" temp.in
+        printf '\0'
+    done > temp.versions
+    start=$(date +%s%N)
+    ./9cc -O0 --incremental < temp.versions > /dev/null 2>&1 || exit 1
+    end=$(date +%s%N)
+    printf "%-14s %-14s %8d us\n" "$name" "--incremental" $(((end - start) / versions / 1000))
+    start=$(date +%s%N)
+    for ((v = 0; v < versions; v++)); do
+        ./9cc -O0 - < temp.in > /dev/null || exit 1
+    done
+    end=$(date +%s%N)
+    printf "%-14s %-14s %8d us\n" "$name" "whole" $(((end - start) / versions / 1000))
+}
+
+bench_incremental() {
+    echo "-O0 --incremental against -O0 on each version, per version editing one statement"
+    chain 2000 > temp.in
+    measure_incremental "chain 2000" 1000 50
+    chain 20000 > temp.in
+    measure_incremental "chain 20000" 10000 20
+}
+
+names="$*"
+if [ -z "$names" ]; then
+    names="regalloc exprs run interp incremental"
+fi
+for name in $names; do
+    "bench_$name"
+done
@@ -1,18 +1,292 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "codegen.h"
 #include "error.h"
+#include "insn.h"
 #include "node.h"
+#include "select.h"
 
-void generate_lvalue(Node* node) {
-    if (node->kind != ND_LVAR) {
-        error("left value is not ND_LVAR.");
+/* Register that local variables are addressed from, see generate_prologue(). */
+char* frame_reg = "rbp";
+
+/* True if returns jump to the epilogue at RETURN_LABEL, instead of being a lone `ret`. */
+bool shared_epilogue;
+
+/* True once a return jumped to RETURN_LABEL, which must then be emitted. */
+bool return_jumped;
+
+/*
+ * Prints the prologue of a frame holding `size` bytes of data under the return address, and sets
+ * frame_reg to address them. Returns true if the frame has rbp, which the epilogue restores.
+ *
+ * Leaf code, which moves rsp neither by push, pop nor call, keeps up to RED_ZONE_SIZE bytes under
+ * rsp, where the ABI promises that signal handlers do not write. Other frames are rounded to 16
+ * bytes, so that rsp stays aligned as the ABI requires for calls.
+ */
+bool generate_prologue(int size, bool leaf) {
+    if (size == 0 || (leaf && size <= RED_ZONE_SIZE)) {
+        frame_reg = "rsp";
+        return false;
+    }
+    frame_reg = "rbp";
+    emit("  push rbp\n");
+    emit("  mov rbp, rsp\n");
+    emit("  sub rsp, %d\n", (size + 15) / 16 * 16);
+    return true;
+}
+
+/* Prints the end of the epilogue of a frame made by generate_prologue(). */
+void generate_frame_epilogue(bool frame) {
+    if (frame) {
+        emit("  mov rsp, rbp\n");
+        emit("  pop rbp\n");
+    }
+    emit("  ret\n");
+}
+
+/* Prints a return from the middle of the code, with the value in rax. */
+void generate_return() {
+    if (shared_epilogue) {
+        emit("  jmp " RETURN_LABEL "\n");
+        return_jumped = true;
+    } else {
+        emit("  ret\n");
+    }
+}
+
+/* Returns the bytes of the local variables that the statements of `code` use. */
+int locals_size(Vector* code) {
+    int size = 0;
+    for (int i = 0; i < code->len; i++) {
+        Vector* nodes = postorder_nodes(code->data[i]);
+        for (int j = 0; j < nodes->len; j++) {
+            Node* node = nodes->data[j];
+            if (node->kind == ND_LVAR && node->lvar->offset > size) {
+                size = node->lvar->offset;
+            }
+        }
+        free(nodes->data);
+        free(nodes);
+    }
+    return size;
+}
+
+/* Returns the memory operand of the local variable `node`. */
+char* local_operand(Node* node) {
+    char* operand = calloc(1, 32);
+    sprintf(operand, "qword ptr [%s-%d]", frame_reg, node->lvar->offset);
+    return operand;
+}
+
+/* Returns true if `node` is a number that instructions take as a sign extended immediate. */
+bool is_imm32(Node* node) { return node->kind == ND_NUM && node->val == (int)node->val; }
+
+/*
+ * Returns the operand that generate_binary() of `kind` takes in place of a register holding the
+ * value of `node`, or NULL if there is none. Immediates go to any operator but `idiv`, and local
+ * variables are read from memory.
+ */
+char* direct_operand(NodeKind kind, Node* node) {
+    if (node->kind == ND_LVAR) {
+        return local_operand(node);
+    }
+    if (!is_imm32(node) || kind == ND_DIV) {
+        return NULL;
+    }
+    char* operand = calloc(1, 32);
+    sprintf(operand, "%ld", node->val);
+    return operand;
+}
+
+/* Returns k if `val` is 2^k or -2^k with k >= 1, or 0 otherwise. */
+int log2_abs(long val) {
+    unsigned long abs = val < 0 ? -(unsigned long)val : val;
+    if (abs < 2 || (abs & (abs - 1))) {
+        return 0;
+    }
+    int k = 0;
+    while (abs >>= 1) {
+        k++;
+    }
+    return k;
+}
+
+/*
+ * Returns the magic number of `divisor`, where 2 <= |divisor| and divisor is not a power of two,
+ * so that n / divisor is the high 64 bits of n * multiplier, plus n if the signs of the divisor
+ * and the multiplier differ, shifted right arithmetically by shift and rounded toward zero.
+ *
+ * This is the search of Granlund and Montgomery, as written in Hacker's Delight 10-1, for the
+ * smallest shift whose multiplier gives the exact quotient for every 64 bit n.
+ */
+Magic signed_magic(long divisor) {
+    unsigned long two63 = 1UL << 63;
+    unsigned long ad = divisor < 0 ? -(unsigned long)divisor : divisor;
+    unsigned long t = two63 + ((unsigned long)divisor >> 63);
+    /* Absolute value of the largest n that is one less than a multiple of the divisor. */
+    unsigned long anc = t - 1 - t % ad;
+    unsigned long q1 = two63 / anc;
+    unsigned long r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad;
+    unsigned long r2 = two63 - q2 * ad;
+    unsigned long delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    long multiplier = q2 + 1;
+    return (Magic){divisor < 0 ? -multiplier : multiplier, p - 64};
+}
+
+/* Return true if `kind` by the constant `val` has a strength reduced sequence. */
+bool by_constant(NodeKind kind, long val) {
+    switch (kind) {
+    case ND_SHL:
+        return true;
+    case ND_MUL:
+        /* `imul` takes a sign extended 32 bit immediate at most. */
+        return val == (int)val;
+    case ND_DIV:
+        /* 0 and -1 are left to `idiv`, which traps like the program expects. */
+        return val != 0 && val != -1 && val != 1;
+    default:
+        return false;
+    }
+}
+
+/* Computes `reg` = `reg` `kind` `val`, where by_constant(kind, val) is true and `reg` is a
+ * register other than rcx, rdx and rdi. */
+void generate_by_constant(NodeKind kind, char* reg, long val) {
+    switch (kind) {
+    case ND_SHL:
+        emit("  shl %s, %ld\n", reg, val & 63);
+        return;
+    case ND_MUL:
+        /* `lea` computes base + index * scale, with scale of 1, 2, 4 or 8. */
+        if (val == 3 || val == 5 || val == 9) {
+            emit("  lea %s, [%s+%s*%ld]\n", reg, reg, reg, val - 1);
+        } else {
+            emit("  imul %s, %s, %ld\n", reg, reg, val);
+        }
+        return;
+    case ND_DIV: {
+        /* The sequences divide rax. */
+        if (strcmp(reg, "rax") != 0) {
+            emit("  mov rax, %s\n", reg);
+            generate_by_constant(kind, "rax", val);
+            emit("  mov %s, rax\n", reg);
+            return;
+        }
+        if (!log2_abs(val)) {
+            /* `imul` with one operand puts the 128 bit product in rdx:rax. */
+            Magic magic = signed_magic(val);
+            emit("  mov rcx, rax\n");
+            emit("  mov rax, %ld\n", magic.multiplier);
+            emit("  imul rcx\n");
+            if (val > 0 && magic.multiplier < 0) {
+                emit("  add rdx, rcx\n");
+            } else if (val < 0 && magic.multiplier > 0) {
+                emit("  sub rdx, rcx\n");
+            }
+            if (magic.shift > 0) {
+                emit("  sar rdx, %d\n", magic.shift);
+            }
+            /* Adds 1 to a negative quotient to round toward zero. */
+            emit("  mov rax, rdx\n");
+            emit("  shr rax, 63\n");
+            emit("  add rax, rdx\n");
+            return;
+        }
+        /* `sar` alone rounds toward negative infinity, so negative dividends are biased by
+         * 2^k - 1 first to round toward zero like `idiv`. */
+        int k = log2_abs(val);
+        emit("  mov rdi, rax\n");
+        emit("  sar rdi, 63\n");
+        emit("  shr rdi, %d\n", 64 - k);
+        emit("  add rax, rdi\n");
+        emit("  sar rax, %d\n", k);
+        if (val < 0) {
+            emit("  neg rax\n");
+        }
+        return;
     }
+    default:
+        return;
+    }
+}
 
-    /* Push variable address value located at [Base pointer + offset]. */
-    printf("  mov rax, rbp\n");
-    printf("  sub rax, %d\n", node->lvar->offset);
-    printf("  push rax\n");
+/* Computes `dst` = `dst` `kind` `src`, where neither is rcx or rdx. */
+void generate_binary(NodeKind kind, char* dst, char* src) {
+    switch (kind) {
+    case ND_ADD:
+        emit("  add %s, %s\n", dst, src);
+        break;
+    case ND_SUB:
+        emit("  sub %s, %s\n", dst, src);
+        break;
+    case ND_MUL:
+        emit("  imul %s, %s\n", dst, src);
+        break;
+    case ND_SHL:
+        emit("  mov rcx, %s\n", src);
+        emit("  shl %s, cl\n", dst);
+        break;
+    case ND_DIV:
+        if (strcmp(dst, "rax") != 0) {
+            emit("  mov rax, %s\n", dst);
+        }
+        /* https://www.felixcloutier.com/x86/cwd:cdq:cqo */
+        /* `CQO` instruction (available in 64-bit mode only) copies the sign (bit63)
+         * of the value in the RAX register into every bit position in the RDX register.  */
+        emit("  cqo\n");
+        /* https://www.tutorialspoint.com/assembly_programming/assembly_arithmetic_instructions.htm
+         */
+        /* `idiv` does EDX:EAX / 32bit divisor = EAX(Quotient) and EDX(Remainder) */
+        emit("  idiv %s\n", src);
+        if (strcmp(dst, "rax") != 0) {
+            emit("  mov %s, rax\n", dst);
+        }
+        break;
+    case ND_EQ:
+        emit("  cmp %s, %s\n", dst, src);
+        emit("  sete al\n");
+        emit("  movzb %s, al\n", dst);
+        break;
+    case ND_NEQ:
+        emit("  cmp %s, %s\n", dst, src);
+        emit("  setne al\n");
+        emit("  movzb %s, al\n", dst);
+        break;
+    case ND_LT:
+        emit("  cmp %s, %s\n", dst, src);
+        emit("  setl al\n");
+        emit("  movzb %s, al\n", dst);
+        break;
+    case ND_LTE:
+        emit("  cmp %s, %s\n", dst, src);
+        emit("  setle al\n");
+        emit("  movzb %s, al\n", dst);
+        break;
+    default:
+        break;
+    }
 }
 
 /*
@@ -43,96 +317,181 @@ void generate_lvalue(Node* node) {
  *    A
  *   / \
  * lhs rhs
+ *
+ * Emits the code of `node` that follows its first `state` generated children, and returns the
+ * next child to generate or NULL when the node is done.
  */
-void generate_asm_code(Node* node) {
+Node* generate_asm_step(Node* node, int state, void* arg) {
     switch (node->kind) {
     case ND_NUM:
-        printf("  push %d\n", node->val);
-        return;
+        /* `push` takes a sign extended 32 bit immediate at most. */
+        if (node->val == (int)node->val) {
+            emit("  push %ld\n", node->val);
+        } else {
+            emit("  mov rax, %ld\n", node->val);
+            emit("  push rax\n");
+        }
+        return NULL;
     case ND_LVAR:
-        /* Generate_lvalue pushes variable address value to the bottom of the stack. */
-        generate_lvalue(node);
-
-        /* Takes the address value to rax. */
-        printf("  pop rax\n");
-        /* Copies the value which the address holds of rax to rax. */
-        printf("  mov rax, [rax]\n");
-        printf("  push rax\n");
-        return;
+        emit("  push %s\n", local_operand(node));
+        return NULL;
     case ND_ASSIGN:
-        generate_lvalue(node->lhs);
-        generate_asm_code(node->rhs);
-
-        /* Takes value of generate_asm_code. */
-        printf("  pop rdi\n");
-        /* Takes address value of generate_lvalue. */
-        printf("  pop rax\n");
-        /* Copies the value of generate_asm_code to generate_lvalue. */
-        printf("  mov [rax], rdi\n");
-        printf("  push rdi\n");
-        return;
+        /* Stores to the variable directly, instead of through its address on the stack. */
+        if (is_imm32(node->rhs)) {
+            emit("  mov %s, %ld\n", local_operand(node->lhs), node->rhs->val);
+            emit("  push %ld\n", node->rhs->val);
+            return NULL;
+        }
+        if (state == 0) {
+            return node->rhs;
+        }
+        emit("  pop rdi\n");
+        emit("  mov %s, rdi\n", local_operand(node->lhs));
+        emit("  push rdi\n");
+        return NULL;
     case ND_RETURN:
-        generate_asm_code(node->lhs);
+        if (state == 0) {
+            return node->lhs;
+        }
 
-        printf("  pop rax\n");
-        printf("  mov rsp, rbp\n");
-        printf("  pop rbp\n");
-        printf("  ret\n");
-        return;
+        emit("  pop rax\n");
+        generate_return();
+        return NULL;
     default:
         break;
     }
 
     /* Calculate `lhs` and `rhs`, then push each value to stack. */
-    generate_asm_code(node->lhs);
-    generate_asm_code(node->rhs);
+    /* Some operators by a constant, and operands that instructions take directly, do not need
+     * `rhs` on the stack. */
+    if (state == 0) {
+        return node->lhs;
+    }
+    if (node->rhs->kind == ND_NUM && by_constant(node->kind, node->rhs->val)) {
+        emit("  pop rax\n");
+        generate_by_constant(node->kind, "rax", node->rhs->val);
+        emit("  push rax\n");
+        return NULL;
+    }
+    char* operand = direct_operand(node->kind, node->rhs);
+    if (operand) {
+        emit("  pop rax\n");
+        generate_binary(node->kind, "rax", operand);
+        emit("  push rax\n");
+        return NULL;
+    }
+    if (state == 1) {
+        return node->rhs;
+    }
 
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
+    emit("  pop rdi\n");
+    emit("  pop rax\n");
 
-    switch (node->kind) {
-    case ND_ADD:
-        printf("  add rax, rdi\n");
-        break;
-    case ND_SUB:
-        printf("  sub rax, rdi\n");
-        break;
-    case ND_MUL:
-        printf("  imul rax, rdi\n");
-        break;
-    case ND_DIV:
-        /* https://www.felixcloutier.com/x86/cwd:cdq:cqo */
-        /* `CQO` instruction (available in 64-bit mode only) copies the sign (bit63)
-         * of the value in the RAX register into every bit position in the RDX register.  */
-        printf("  cqo\n");
-        /* https://www.tutorialspoint.com/assembly_programming/assembly_arithmetic_instructions.htm
-         */
-        /* `idiv` does EDX:EAX / 32bit divisor = EAX(Quotient) and EDX(Remainder) */
-        printf("  idiv rdi\n");
-        break;
-    case ND_EQ:
-        printf("  cmp rax, rdi\n");
-        printf("  sete al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_NEQ:
-        printf("  cmp rax, rdi\n");
-        printf("  setne al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_LT:
-        printf("  cmp rax, rdi\n");
-        printf("  setl al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_LTE:
-        printf("  cmp rax, rdi\n");
-        printf("  setle al\n");
-        printf("  movzb rax, al\n");
-        break;
-    default:
-        break;
+    generate_binary(node->kind, "rax", "rdi");
+    emit("  push rax\n");
+    return NULL;
+}
+
+/* Calls `step` with each node of the tree of `root` until it returns NULL for `root`. */
+void generate_steps(Node* root, GenerateStep step, void* arg) {
+    /* Nodes whose children are being generated are kept on a heap allocated work stack
+     * instead of the C stack, so deep trees cannot overflow it. */
+    int capacity = 16;
+    int len = 0;
+    Frame* frames = calloc(capacity, sizeof(Frame));
+    frames[len++] = (Frame){root, 0};
+
+    while (len > 0) {
+        Frame* frame = &frames[len - 1];
+        Node* child = step(frame->node, frame->state++, arg);
+        if (!child) {
+            len--;
+            continue;
+        }
+        if (len == capacity) {
+            capacity *= 2;
+            frames = realloc(frames, sizeof(Frame) * capacity);
+            if (!frames) {
+                error("out of memory.");
+            }
+        }
+        frames[len++] = (Frame){child, 0};
+    }
+
+    free(frames);
+}
+
+void generate_asm_code(Node* node) { generate_steps(node, generate_asm_step, NULL); }
+
+/* Prints the directives before the code of main. */
+void generate_header() {
+    emit(".intel_syntax noprefix\n");
+    emit(".global main\n");
+    emit("main:\n");
+}
+
+/*
+ * Prints the code of the statement `node` with values in registers as selected from `labels`, or
+ * on the machine stack if `labels` is NULL. The value of the `last` statement is returned, so its
+ * `return` runs into the epilogue.
+ */
+void generate_statement(Node* node, Labels* labels, bool last) {
+    if (last && node->kind == ND_RETURN) {
+        node = node->lhs;
     }
+    if (labels) {
+        select_statement(node, labels, last);
+        return;
+    }
+    generate_asm_code(node);
+
+    /* Always ends with `push rax`, so apply `pop` not to overflow stack. */
+    if (node->kind != ND_RETURN) {
+        emit("  pop rax\n");
+    }
+}
+
+/*
+ * Prints the whole assembly of the program made of `code` statements, with values in registers or
+ * on the machine stack if `stack_machine` is true.
+ */
+void generate_program(Vector* code, bool stack_machine) {
+    generate_header();
+
+    /* Nothing runs into the statements after a `return`. */
+    int len = 0;
+    while (len < code->len && ((Node*)code->data[len++])->kind != ND_RETURN) {
+    }
+
+    /* Values in registers push only when a statement needs more of them. */
+    Vector* labels = stack_machine ? NULL : label_statements(code, len);
+    bool leaf = !stack_machine && fits_registers(labels);
+    bool frame = generate_prologue(locals_size(code), leaf);
+    shared_epilogue = frame;
+    return_jumped = false;
+
+    /* Generate code from code[0]. */
+    for (int i = 0; i < len; i++) {
+        generate_statement(code->data[i], labels ? labels->data[i] : NULL, i == len - 1);
+        if (labels) {
+            free_labels(labels->data[i]);
+        }
+    }
+    if (labels) {
+        free(labels->data);
+        free(labels);
+    }
+
+    /* Epilogue. */
+    if (return_jumped) {
+        emit(RETURN_LABEL ":\n");
+    }
+    generate_frame_epilogue(frame);
+}
 
-    printf("  push rax\n");
+/* Prints a program that only returns `val`, which needs no frame. */
+void generate_return_program(long val) {
+    generate_header();
+    emit("  mov rax, %ld\n", val);
+    emit("  ret\n");
 }
@@ -1,10 +1,74 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
+#include <stdbool.h>
+
 #include "node.h"
+#include "select.h"
+
+/* Bytes under rsp that leaf code may use without moving rsp. */
+#define RED_ZONE_SIZE 128
+
+/* Label of the epilogue that returns jump to when it is shared. */
+#define RETURN_LABEL ".L.return"
+
+extern char* frame_reg;
+
+extern bool shared_epilogue;
+
+extern bool return_jumped;
+
+/* Node whose code is being generated and how many of its children are already done. */
+typedef struct {
+    Node* node;
+    int state;
+} Frame;
+
+/* Emits the code of `node` after its first `state` children, and returns the next child. */
+typedef Node* (*GenerateStep)(Node* node, int state, void* arg);
+
+/* Multiplier and shift that divide by a constant, see signed_magic. */
+typedef struct {
+    long multiplier;
+    int shift;
+} Magic;
+
+bool generate_prologue(int size, bool leaf);
+
+void generate_frame_epilogue(bool frame);
+
+void generate_return();
+
+int locals_size(Vector* code);
 
-void generate_lvalue(Node* node);
+char* local_operand(Node* node);
+
+bool is_imm32(Node* node);
+
+char* direct_operand(NodeKind kind, Node* node);
+
+int log2_abs(long val);
+
+Magic signed_magic(long divisor);
+
+bool by_constant(NodeKind kind, long val);
+
+void generate_by_constant(NodeKind kind, char* reg, long val);
+
+void generate_binary(NodeKind kind, char* dst, char* src);
+
+Node* generate_asm_step(Node* node, int state, void* arg);
+
+void generate_steps(Node* root, GenerateStep step, void* arg);
 
 void generate_asm_code(Node* node);
 
+void generate_header();
+
+void generate_statement(Node* node, Labels* labels, bool last);
+
+void generate_program(Vector* code, bool stack_machine);
+
+void generate_return_program(long val);
+
 #endif // !CODEGEN_H
@@ -0,0 +1,621 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "coloring.h"
+#include "ir.h"
+#include "map.h"
+#include "regalloc.h"
+#include "vector.h"
+#include "x86.h"
+
+/*
+ * Register allocation by graph coloring, with the iterated register coalescing of George and
+ * Appel over the simplification of Chaitin and Briggs.
+ *
+ * Virtual registers interfere when one is live where the other is defined. A binary operation
+ * that x86 computes in place, like `add dst, rhs`, wants `dst` in the register of `lhs`, so the
+ * pair is a move to coalesce, as is a phi and each of its arguments. Assignment chains leave no
+ * moves, SSA construction already gave the whole chain one register.
+ *
+ * Registers of degree under ALLOC_REG_COUNT are removed from the graph one by one, and colored
+ * in the reverse order, when a color is sure to be left for them. Moves are coalesced only when
+ * the merged register stays colorable by the tests of Briggs or George, and are frozen when
+ * neither simplification nor coalescing can go on. When every register left has a high degree,
+ * the one of least cost over squared degree, where the cost counts its definitions and uses, is
+ * pushed optimistically, and spilled if no color is left for it in the end. Registers take the
+ * color of a register they were moved to or from when it is free, which still saves the moves
+ * that were frozen.
+ *
+ * Spilled registers are read from memory by the instruction templates, so unlike the original
+ * algorithm, no spill code is inserted and the graph is not built again. Spilled registers that
+ * do not interfere share stack slots.
+ */
+
+typedef enum {
+    NODE_NONE, // Register not used by the program.
+    NODE_INITIAL,
+    NODE_SIMPLIFY,
+    NODE_FREEZE,
+    NODE_SPILL,
+    NODE_SELECT,
+    NODE_COALESCED,
+    NODE_COLORED,
+    NODE_SPILLED,
+} NodeState;
+
+typedef enum {
+    MOVE_WORKLIST,
+    MOVE_ACTIVE,
+    MOVE_COALESCED,
+    MOVE_CONSTRAINED,
+    MOVE_FROZEN,
+} MoveState;
+
+typedef struct {
+    int dst;
+    int src;
+    MoveState state;
+} Move;
+
+/*
+ * Nodes are virtual registers. The worklists hold registers as pointers, and an entry is stale
+ * when the state of the register changed since it was pushed.
+ */
+typedef struct {
+    int node_count;
+    Map* edges; // Key of each edge, see edge_key().
+    Vector** adj;
+    int* degree;
+    int* cost; // Definitions and uses, each one run once since programs have no loops.
+    int* alias;
+    int* color;
+    NodeState* state;
+    Vector** move_list;
+    Vector* simplify_list;
+    Vector* freeze_list;
+    Vector* spill_list;
+    Vector* move_worklist;
+    Vector* select_stack;
+    int* mark; // Stamps of visited nodes.
+    int stamp;
+    bool* unplaced; // Registers left out of the graph, see unplaced_regs().
+} Graph;
+
+/* Set of live registers, iterated in the order they were added. */
+typedef struct {
+    int* members;
+    int* index;
+    int len;
+} LiveSet;
+
+bool live_contains(LiveSet* live, int reg) {
+    int i = live->index[reg];
+    return i < live->len && live->members[i] == reg;
+}
+
+void live_add(LiveSet* live, int reg) {
+    if (!live_contains(live, reg)) {
+        live->index[reg] = live->len;
+        live->members[live->len++] = reg;
+    }
+}
+
+void live_remove(LiveSet* live, int reg) {
+    if (live_contains(live, reg)) {
+        int last = live->members[--live->len];
+        live->members[live->index[reg]] = last;
+        live->index[last] = live->index[reg];
+    }
+}
+
+void* edge_key(Graph* g, int u, int v) {
+    long lo = u < v ? u : v;
+    long hi = u < v ? v : u;
+    return (void*)(lo * g->node_count + hi);
+}
+
+bool has_edge(Graph* g, int u, int v) { return map_contains(g->edges, edge_key(g, u, v)); }
+
+void add_edge(Graph* g, int u, int v) {
+    if (u == v || g->unplaced[u] || g->unplaced[v] || has_edge(g, u, v)) {
+        return;
+    }
+    map_put(g->edges, edge_key(g, u, v), g);
+    vec_push(g->adj[u], (void*)(long)v);
+    vec_push(g->adj[v], (void*)(long)u);
+    g->degree[u]++;
+    g->degree[v]++;
+}
+
+void push_node(Vector* list, int n) { vec_push(list, (void*)(long)n); }
+
+/* Pops a register in `state` from `list` into `n`, skipping stale entries. */
+bool pop_node(Graph* g, Vector* list, NodeState state, int* n) {
+    while (list->len > 0) {
+        *n = (int)(long)vec_pop(list);
+        if (g->state[*n] == state) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void use_node(Graph* g, int reg) {
+    if (g->unplaced[reg]) {
+        return;
+    }
+    g->state[reg] = NODE_INITIAL;
+    g->cost[reg]++;
+}
+
+void add_move(Graph* g, int dst, int src) {
+    if (g->unplaced[dst] || g->unplaced[src]) {
+        return;
+    }
+    Move* move = calloc(1, sizeof(Move));
+    *move = (Move){dst, src, MOVE_WORKLIST};
+    vec_push(g->move_list[dst], move);
+    vec_push(g->move_list[src], move);
+    vec_push(g->move_worklist, move);
+}
+
+/* Counts the registers of `ir` for their spill cost, and adds its moves. */
+void add_moves(Graph* g, Ir* ir) {
+    if (ir->dst) {
+        use_node(g, ir->dst);
+    }
+    if (ir->kind == IR_BIN && two_address_op(ir->op)) {
+        add_move(g, ir->dst, ir->lhs);
+    }
+    if (ir->kind == IR_PHI) {
+        for (int i = 0; i < ir->args->len; i++) {
+            int arg = (int)(long)ir->args->data[i];
+            use_node(g, arg);
+            add_move(g, ir->dst, arg);
+        }
+    }
+}
+
+typedef struct {
+    Graph* g;
+    LiveSet* live;
+} UseScan;
+
+void scan_use(int reg, void* arg) {
+    UseScan* scan = arg;
+    if (scan->g) {
+        use_node(scan->g, reg);
+    }
+    live_add(scan->live, reg);
+}
+
+/*
+ * Walks the program backward over the live registers, and returns how many of them are live
+ * where a register is defined, which bounds the number of edges. Builds the interference graph
+ * into `g` unless it is NULL.
+ */
+long scan_interference(IrProgram* prog, Graph* g) {
+    int reg_count = prog->reg_count;
+    bool** live_in = block_live_in(prog);
+    bool* live_out = calloc(reg_count + 1, sizeof(bool));
+    LiveSet live = {calloc(reg_count + 1, sizeof(int)), calloc(reg_count + 1, sizeof(int)), 0};
+    UseScan scan = {g, &live};
+    long pairs = 0;
+
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        block_live_out(block, live_in, reg_count, live_out);
+        live.len = 0;
+        for (int reg = 1; reg <= reg_count; reg++) {
+            if (live_out[reg]) {
+                live_add(&live, reg);
+            }
+        }
+
+        for (int j = block->irs->len - 1; j >= 0; j--) {
+            Ir* ir = block->irs->data[j];
+            if (ir->dst) {
+                pairs += live.len;
+                for (int k = 0; g && k < live.len; k++) {
+                    add_edge(g, ir->dst, live.members[k]);
+                }
+                /* Phis are defined together at the top of the block, so they stay live. */
+                if (ir->kind != IR_PHI) {
+                    live_remove(&live, ir->dst);
+                }
+            }
+            if (g) {
+                add_moves(g, ir);
+            }
+            for_each_use(ir, scan_use, &scan);
+        }
+    }
+
+    free_live_in(prog, live_in);
+    free(live_out);
+    free(live.members);
+    free(live.index);
+    return pairs;
+}
+
+/* Registers not yet removed from the graph by simplification or coalescing. */
+bool in_graph(Graph* g, int n) {
+    return g->state[n] != NODE_SELECT && g->state[n] != NODE_COALESCED;
+}
+
+bool move_pending(Move* move) {
+    return move->state == MOVE_WORKLIST || move->state == MOVE_ACTIVE;
+}
+
+bool move_related(Graph* g, int n) {
+    for (int i = 0; i < g->move_list[n]->len; i++) {
+        if (move_pending(g->move_list[n]->data[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int get_alias(Graph* g, int n) {
+    while (g->state[n] == NODE_COALESCED) {
+        n = g->alias[n];
+    }
+    return n;
+}
+
+void make_worklists(Graph* g) {
+    for (int n = 1; n < g->node_count; n++) {
+        if (g->state[n] != NODE_INITIAL) {
+            continue;
+        }
+        if (g->degree[n] >= ALLOC_REG_COUNT) {
+            g->state[n] = NODE_SPILL;
+            push_node(g->spill_list, n);
+        } else if (move_related(g, n)) {
+            g->state[n] = NODE_FREEZE;
+            push_node(g->freeze_list, n);
+        } else {
+            g->state[n] = NODE_SIMPLIFY;
+            push_node(g->simplify_list, n);
+        }
+    }
+}
+
+/* Gives the moves of `n` waiting for a neighbor to lose degree another chance. */
+void enable_moves(Graph* g, int n) {
+    for (int i = 0; i < g->move_list[n]->len; i++) {
+        Move* move = g->move_list[n]->data[i];
+        if (move->state == MOVE_ACTIVE) {
+            move->state = MOVE_WORKLIST;
+            vec_push(g->move_worklist, move);
+        }
+    }
+}
+
+void decrement_degree(Graph* g, int m) {
+    int degree = g->degree[m]--;
+    if (degree != ALLOC_REG_COUNT || g->state[m] != NODE_SPILL) {
+        return;
+    }
+    enable_moves(g, m);
+    for (int i = 0; i < g->adj[m]->len; i++) {
+        int n = (int)(long)g->adj[m]->data[i];
+        if (in_graph(g, n)) {
+            enable_moves(g, n);
+        }
+    }
+    if (move_related(g, m)) {
+        g->state[m] = NODE_FREEZE;
+        push_node(g->freeze_list, m);
+    } else {
+        g->state[m] = NODE_SIMPLIFY;
+        push_node(g->simplify_list, m);
+    }
+}
+
+void simplify_register(Graph* g, int n) {
+    g->state[n] = NODE_SELECT;
+    push_node(g->select_stack, n);
+    for (int i = 0; i < g->adj[n]->len; i++) {
+        int m = (int)(long)g->adj[n]->data[i];
+        if (in_graph(g, m)) {
+            decrement_degree(g, m);
+        }
+    }
+}
+
+/* Lets `n` be simplified once it has no moves left to coalesce. */
+void add_worklist(Graph* g, int n) {
+    if (g->state[n] == NODE_FREEZE && !move_related(g, n) && g->degree[n] < ALLOC_REG_COUNT) {
+        g->state[n] = NODE_SIMPLIFY;
+        push_node(g->simplify_list, n);
+    }
+}
+
+/* Briggs: the merged register has fewer than ALLOC_REG_COUNT neighbors of high degree. */
+bool briggs(Graph* g, int u, int v) {
+    g->stamp++;
+    int high = 0;
+    int nodes[2] = {u, v};
+    for (int i = 0; i < 2; i++) {
+        Vector* adj = g->adj[nodes[i]];
+        for (int j = 0; j < adj->len; j++) {
+            int t = (int)(long)adj->data[j];
+            if (in_graph(g, t) && g->mark[t] != g->stamp) {
+                g->mark[t] = g->stamp;
+                high += g->degree[t] >= ALLOC_REG_COUNT;
+            }
+        }
+    }
+    return high < ALLOC_REG_COUNT;
+}
+
+/* George: every neighbor of `v` of high degree already interferes with `u`. */
+bool george(Graph* g, int u, int v) {
+    for (int i = 0; i < g->adj[v]->len; i++) {
+        int t = (int)(long)g->adj[v]->data[i];
+        if (in_graph(g, t) && g->degree[t] >= ALLOC_REG_COUNT && !has_edge(g, t, u)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Merges `v` into `u`. */
+void combine(Graph* g, int u, int v) {
+    g->state[v] = NODE_COALESCED;
+    g->alias[v] = u;
+    g->cost[u] += g->cost[v];
+    for (int i = 0; i < g->move_list[v]->len; i++) {
+        vec_push(g->move_list[u], g->move_list[v]->data[i]);
+    }
+    enable_moves(g, v);
+    for (int i = 0; i < g->adj[v]->len; i++) {
+        int t = (int)(long)g->adj[v]->data[i];
+        if (in_graph(g, t)) {
+            add_edge(g, t, u);
+            decrement_degree(g, t);
+        }
+    }
+    if (g->degree[u] >= ALLOC_REG_COUNT && g->state[u] == NODE_FREEZE) {
+        g->state[u] = NODE_SPILL;
+        push_node(g->spill_list, u);
+    }
+}
+
+void coalesce(Graph* g, Move* move) {
+    int u = get_alias(g, move->dst);
+    int v = get_alias(g, move->src);
+    if (u == v) {
+        move->state = MOVE_COALESCED;
+        add_worklist(g, u);
+    } else if (has_edge(g, u, v)) {
+        move->state = MOVE_CONSTRAINED;
+        add_worklist(g, u);
+        add_worklist(g, v);
+    } else if (briggs(g, u, v) || george(g, u, v)) {
+        move->state = MOVE_COALESCED;
+        combine(g, u, v);
+        add_worklist(g, u);
+    } else {
+        move->state = MOVE_ACTIVE;
+    }
+}
+
+/* Gives up coalescing the moves of `u`. */
+void freeze_moves(Graph* g, int u) {
+    for (int i = 0; i < g->move_list[u]->len; i++) {
+        Move* move = g->move_list[u]->data[i];
+        if (!move_pending(move)) {
+            continue;
+        }
+        move->state = MOVE_FROZEN;
+        int v = get_alias(g, move->src) == get_alias(g, u) ? get_alias(g, move->dst)
+                                                           : get_alias(g, move->src);
+        if (g->state[v] == NODE_FREEZE && !move_related(g, v) &&
+            g->degree[v] < ALLOC_REG_COUNT) {
+            g->state[v] = NODE_SIMPLIFY;
+            push_node(g->simplify_list, v);
+        }
+    }
+}
+
+/*
+ * Pushes the register that may be spilled, the one of least cost over its squared degree as
+ * Bernstein et al. suggest, which favors registers live across many others.
+ */
+void select_spill(Graph* g) {
+    int best = 0;
+    int len = 0;
+    for (int i = 0; i < g->spill_list->len; i++) {
+        int n = (int)(long)g->spill_list->data[i];
+        if (g->state[n] != NODE_SPILL) {
+            continue;
+        }
+        g->spill_list->data[len++] = (void*)(long)n;
+        long n_degree = g->degree[n];
+        long best_degree = best ? g->degree[best] : 0;
+        if (!best || g->cost[n] * best_degree * best_degree < g->cost[best] * n_degree * n_degree) {
+            best = n;
+        }
+    }
+    g->spill_list->len = len;
+    if (!best) {
+        return;
+    }
+    g->state[best] = NODE_SIMPLIFY;
+    push_node(g->simplify_list, best);
+    freeze_moves(g, best);
+}
+
+void assign_colors(Graph* g) {
+    while (g->select_stack->len > 0) {
+        int n = (int)(long)vec_pop(g->select_stack);
+        int taken = 0;
+        for (int i = 0; i < g->adj[n]->len; i++) {
+            int w = get_alias(g, (int)(long)g->adj[n]->data[i]);
+            if (g->state[w] == NODE_COLORED) {
+                taken |= 1 << g->color[w];
+            }
+        }
+        /* The color of a register moved to or from `n`, else the lowest free color so that
+         * fewer callee-saved registers are saved. */
+        int color = 0;
+        while (color < ALLOC_REG_COUNT && taken & 1 << color) {
+            color++;
+        }
+        for (int i = 0; color < ALLOC_REG_COUNT && i < g->move_list[n]->len; i++) {
+            Move* move = g->move_list[n]->data[i];
+            int other = get_alias(g, move->dst) == n ? get_alias(g, move->src)
+                                                     : get_alias(g, move->dst);
+            if (g->state[other] == NODE_COLORED && !(taken & 1 << g->color[other])) {
+                color = g->color[other];
+                break;
+            }
+        }
+        if (color == ALLOC_REG_COUNT) {
+            g->state[n] = NODE_SPILLED;
+        } else {
+            g->state[n] = NODE_COLORED;
+            g->color[n] = color;
+        }
+    }
+}
+
+/* Gives each spilled register the lowest stack slot its spilled neighbors do not hold. */
+void assign_slots(Graph* g, Allocation* alloc) {
+    /* Edges between spilled registers, gathered over the coalesced ones too. */
+    Vector** conflicts = calloc(g->node_count, sizeof(Vector*));
+    for (int n = 1; n < g->node_count; n++) {
+        int u = get_alias(g, n);
+        for (int i = 0; g->state[u] == NODE_SPILLED && i < g->adj[n]->len; i++) {
+            int v = get_alias(g, (int)(long)g->adj[n]->data[i]);
+            if (g->state[v] == NODE_SPILLED) {
+                conflicts[u] = conflicts[u] ? conflicts[u] : create_vector();
+                vec_push(conflicts[u], (void*)(long)v);
+            }
+        }
+    }
+
+    int* slots = calloc(g->node_count, sizeof(int));
+    for (int n = 1; n < g->node_count; n++) {
+        if (g->state[n] != NODE_SPILLED) {
+            continue;
+        }
+        g->stamp++;
+        for (int i = 0; conflicts[n] && i < conflicts[n]->len; i++) {
+            g->mark[slots[(int)(long)conflicts[n]->data[i]]] = g->stamp;
+        }
+        int slot = 1;
+        while (g->mark[slot] == g->stamp) {
+            slot++;
+        }
+        slots[n] = slot;
+        if (slot > alloc->slot_count) {
+            alloc->slot_count = slot;
+        }
+        if (conflicts[n]) {
+            free(conflicts[n]->data);
+            free(conflicts[n]);
+        }
+    }
+    free(conflicts);
+
+    for (int n = 1; n < g->node_count; n++) {
+        if (g->state[n] == NODE_NONE) {
+            continue;
+        }
+        int root = get_alias(g, n);
+        if (g->state[root] == NODE_COLORED) {
+            alloc->regs[n] = g->color[root];
+            alloc->used |= 1 << g->color[root];
+        } else {
+            alloc->slots[n] = slots[root];
+            alloc->spilled++;
+        }
+    }
+    free(slots);
+}
+
+Graph* create_graph(int reg_count) {
+    Graph* g = calloc(1, sizeof(Graph));
+    g->node_count = reg_count + 1;
+    g->edges = create_map();
+    g->adj = calloc(g->node_count, sizeof(Vector*));
+    g->move_list = calloc(g->node_count, sizeof(Vector*));
+    for (int n = 0; n < g->node_count; n++) {
+        g->adj[n] = create_vector();
+        g->move_list[n] = create_vector();
+    }
+    g->degree = calloc(g->node_count, sizeof(int));
+    g->cost = calloc(g->node_count, sizeof(int));
+    g->alias = calloc(g->node_count, sizeof(int));
+    g->color = calloc(g->node_count, sizeof(int));
+    g->state = calloc(g->node_count, sizeof(NodeState));
+    g->mark = calloc(g->node_count + 1, sizeof(int));
+    g->simplify_list = create_vector();
+    g->freeze_list = create_vector();
+    g->spill_list = create_vector();
+    g->move_worklist = create_vector();
+    g->select_stack = create_vector();
+    return g;
+}
+
+void free_graph(Graph* g) {
+    for (int n = 0; n < g->node_count; n++) {
+        free(g->adj[n]->data);
+        free(g->adj[n]);
+        free(g->move_list[n]->data);
+        free(g->move_list[n]);
+    }
+    free(g->edges->keys);
+    free(g->edges->vals);
+    free(g->edges);
+    free(g->adj);
+    free(g->move_list);
+    free(g->degree);
+    free(g->cost);
+    free(g->alias);
+    free(g->color);
+    free(g->state);
+    free(g->mark);
+    free(g->unplaced);
+    free(g);
+}
+
+Allocation* color_registers(IrProgram* prog) {
+    if (scan_interference(prog, NULL) > COLORING_EDGE_LIMIT) {
+        /* Too many values live at once to build the graph, the intervals are cheaper. */
+        return linear_scan(prog);
+    }
+    Graph* g = create_graph(prog->reg_count);
+    g->unplaced = unplaced_regs(prog);
+    scan_interference(prog, g);
+    make_worklists(g);
+
+    for (;;) {
+        int n;
+        if (pop_node(g, g->simplify_list, NODE_SIMPLIFY, &n)) {
+            simplify_register(g, n);
+        } else if (g->move_worklist->len > 0) {
+            Move* move = vec_pop(g->move_worklist);
+            if (move->state == MOVE_WORKLIST) {
+                coalesce(g, move);
+            }
+        } else if (pop_node(g, g->freeze_list, NODE_FREEZE, &n)) {
+            g->state[n] = NODE_SIMPLIFY;
+            push_node(g->simplify_list, n);
+            freeze_moves(g, n);
+        } else if (g->spill_list->len > 0) {
+            select_spill(g);
+        } else {
+            break;
+        }
+    }
+    assign_colors(g);
+
+    Allocation* alloc = new_allocation(prog->reg_count);
+    assign_slots(g, alloc);
+    free_graph(g);
+    return alloc;
+}
@@ -0,0 +1,12 @@
+#ifndef COLORING_H
+#define COLORING_H
+
+#include "ir.h"
+#include "regalloc.h"
+
+/* Interference edges allowed before the program is given to linear_scan() instead. */
+#define COLORING_EDGE_LIMIT 1000000
+
+Allocation* color_registers(IrProgram* prog);
+
+#endif // !COLORING_H
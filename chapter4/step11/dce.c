@@ -0,0 +1,271 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "dce.h"
+#include "ir.h"
+#include "map.h"
+#include "vector.h"
+
+/*
+ * Dead code elimination.
+ *
+ *   1. Blocks the entry does not reach, such as the statements after a `return`, are removed.
+ *   2. A store is dead if no load can read the variable before it is stored again or the program
+ *      returns. Variables live at each point are found by backward liveness analysis.
+ *   3. An instruction whose register is never used is dead, unless it has an effect. A division
+ *      that may trap is kept. Removing it can make its operands dead in turn.
+ *
+ * Stores and values are removed alternately until neither finds more.
+ */
+
+/* Removes the blocks the entry does not reach, and returns the number of their instructions. */
+int remove_unreachable(IrProgram* prog) {
+    bool* reached = calloc(prog->blocks->len, sizeof(bool));
+    Vector* stack = create_vector();
+    vec_push(stack, prog->blocks->data[0]);
+    reached[0] = true;
+    while (stack->len > 0) {
+        Block* block = vec_pop(stack);
+        for (int i = 0; i < block->succs->len; i++) {
+            Block* succ = block->succs->data[i];
+            if (!reached[succ->id]) {
+                reached[succ->id] = true;
+                vec_push(stack, succ);
+            }
+        }
+    }
+
+    int removed = 0;
+    int len = 0;
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        if (!reached[i]) {
+            removed += block->irs->len;
+            continue;
+        }
+        /* Edges from removed blocks go away with the phi arguments they bring. */
+        int preds = 0;
+        for (int j = 0; j < block->preds->len; j++) {
+            Block* pred = block->preds->data[j];
+            if (!reached[pred->id]) {
+                continue;
+            }
+            for (int k = 0; k < block->irs->len; k++) {
+                Ir* ir = block->irs->data[k];
+                if (ir->kind == IR_PHI) {
+                    ir->args->data[preds] = ir->args->data[j];
+                }
+            }
+            block->preds->data[preds++] = pred;
+        }
+        block->preds->len = preds;
+        for (int k = 0; k < block->irs->len; k++) {
+            Ir* ir = block->irs->data[k];
+            if (ir->kind == IR_PHI) {
+                ir->args->len = preds;
+            }
+        }
+        prog->blocks->data[len++] = block;
+    }
+    prog->blocks->len = len;
+    for (int i = 0; i < len; i++) {
+        ((Block*)prog->blocks->data[i])->id = i;
+    }
+    free(reached);
+    free(stack->data);
+    free(stack);
+    return removed;
+}
+
+/* Index of `lvar` in the liveness sets, counting the variables in `indexes`. */
+int lvar_index(Map* indexes, LVar* lvar) {
+    if (!map_contains(indexes, lvar)) {
+        map_put(indexes, lvar, (void*)(long)(indexes->len + 1));
+    }
+    return (int)(long)map_get(indexes, lvar) - 1;
+}
+
+/* Computes the variables live at the end of `block` into `live`, from the live-in sets. */
+void live_out(Block* block, bool** live_in, int lvar_count, bool* live) {
+    for (int i = 0; i < lvar_count; i++) {
+        live[i] = false;
+    }
+    for (int i = 0; i < block->succs->len; i++) {
+        Block* succ = block->succs->data[i];
+        for (int j = 0; j < lvar_count; j++) {
+            live[j] = live[j] || live_in[succ->id][j];
+        }
+    }
+}
+
+/* Removes from `block` the instructions in `dead`, and returns how many. */
+int sweep_block(Block* block, Map* dead) {
+    int len = 0;
+    for (int i = 0; i < block->irs->len; i++) {
+        Ir* ir = block->irs->data[i];
+        if (!map_contains(dead, ir)) {
+            block->irs->data[len++] = ir;
+        }
+    }
+    int removed = block->irs->len - len;
+    block->irs->len = len;
+    return removed;
+}
+
+/* Walks `block` backward from its live-out set in `live`, leaving its live-in set there. Stores
+ * to variables that are not live are added to `dead` unless it is NULL. */
+void scan_block(Block* block, Map* indexes, bool* live, Map* dead) {
+    for (int i = block->irs->len - 1; i >= 0; i--) {
+        Ir* ir = block->irs->data[i];
+        if (ir->kind == IR_LOAD) {
+            live[lvar_index(indexes, ir->lvar)] = true;
+        } else if (ir->kind == IR_STORE) {
+            int index = lvar_index(indexes, ir->lvar);
+            if (!live[index] && dead) {
+                map_put(dead, ir, ir);
+            }
+            live[index] = false;
+        }
+    }
+}
+
+/* Removes the stores no load can read, and returns how many. */
+int remove_dead_stores(IrProgram* prog) {
+    Map* indexes = create_map();
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            if (ir->lvar) {
+                lvar_index(indexes, ir->lvar);
+            }
+        }
+    }
+    int lvar_count = indexes->len;
+    bool** live_in = calloc(prog->blocks->len, sizeof(bool*));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        live_in[i] = calloc(lvar_count + 1, sizeof(bool));
+    }
+    bool* live = calloc(lvar_count + 1, sizeof(bool));
+
+    /* Live-in sets only grow, so this ends. Visiting backward converges fast without loops. */
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = prog->blocks->len - 1; i >= 0; i--) {
+            Block* block = prog->blocks->data[i];
+            live_out(block, live_in, lvar_count, live);
+            scan_block(block, indexes, live, NULL);
+            for (int j = 0; j < lvar_count; j++) {
+                changed = changed || live[j] != live_in[i][j];
+                live_in[i][j] = live[j];
+            }
+        }
+    }
+
+    Map* dead = create_map();
+    int removed = 0;
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        live_out(block, live_in, lvar_count, live);
+        scan_block(block, indexes, live, dead);
+        removed += sweep_block(block, dead);
+    }
+    for (int i = 0; i < prog->blocks->len; i++) {
+        free(live_in[i]);
+    }
+    free(live_in);
+    free(live);
+    return removed;
+}
+
+/* Returns true if `ir` can be removed when its register is not used. */
+bool removable(Ir* ir, Ir** defs) {
+    switch (ir->kind) {
+    case IR_IMM:
+    case IR_LOAD:
+    case IR_PHI:
+        return true;
+    case IR_BIN: {
+        if (ir->op != ND_DIV) {
+            return true;
+        }
+        /* `idiv` traps on a zero divisor, and on INT64_MIN / -1. */
+        Ir* rhs = defs[ir->rhs];
+        return rhs && rhs->kind == IR_IMM && rhs->val != 0 && rhs->val != -1;
+    }
+    default:
+        return false;
+    }
+}
+
+void use_operands(Ir* ir, int* uses, int delta) {
+    uses[ir->lhs] += delta;
+    uses[ir->rhs] += delta;
+    for (int i = 0; ir->args && i < ir->args->len; i++) {
+        uses[(int)(long)ir->args->data[i]] += delta;
+    }
+}
+
+/* Removes the instructions whose registers are never used, and returns how many. */
+int remove_dead_values(IrProgram* prog) {
+    int* uses = calloc(prog->reg_count + 1, sizeof(int));
+    Ir** defs = calloc(prog->reg_count + 1, sizeof(Ir*));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            use_operands(ir, uses, 1);
+            if (ir->dst) {
+                defs[ir->dst] = ir;
+            }
+        }
+    }
+
+    Map* dead = create_map();
+    Vector* work = create_vector();
+    for (int reg = 1; reg <= prog->reg_count; reg++) {
+        if (defs[reg] && uses[reg] == 0) {
+            vec_push(work, defs[reg]);
+        }
+    }
+    while (work->len > 0) {
+        Ir* ir = vec_pop(work);
+        if (map_contains(dead, ir) || uses[ir->dst] > 0 || !removable(ir, defs)) {
+            continue;
+        }
+        map_put(dead, ir, ir);
+        use_operands(ir, uses, -1);
+        int operands[] = {ir->lhs, ir->rhs};
+        for (int i = 0; i < 2; i++) {
+            if (operands[i] && uses[operands[i]] == 0) {
+                vec_push(work, defs[operands[i]]);
+            }
+        }
+        for (int i = 0; ir->args && i < ir->args->len; i++) {
+            int reg = (int)(long)ir->args->data[i];
+            if (uses[reg] == 0) {
+                vec_push(work, defs[reg]);
+            }
+        }
+    }
+
+    int removed = 0;
+    for (int i = 0; i < prog->blocks->len; i++) {
+        removed += sweep_block(prog->blocks->data[i], dead);
+    }
+    free(uses);
+    free(defs);
+    return removed;
+}
+
+int eliminate_dead_code(IrProgram* prog) {
+    int removed = remove_unreachable(prog);
+    for (;;) {
+        int count = remove_dead_stores(prog) + remove_dead_values(prog);
+        if (count == 0) {
+            return removed;
+        }
+        removed += count;
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "ir.h"
+
+int eliminate_dead_code(IrProgram* prog);
+
+#endif // !DCE_H
@@ -0,0 +1,451 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "error.h"
+#include "insn.h"
+#include "vector.h"
+
+/*
+ * x86-64 machine code of the emitted instructions.
+ *
+ * Each instruction is an opcode between its prefixes and its operands: a REX prefix when it
+ * works on 64 bits or names r8-r15, then the ModRM byte for the register or memory operand, with
+ * a SIB byte for an index or a base of rsp or r12, and the displacement. Where several encodings
+ * exist, the one GNU as chooses is used, so that test.sh can compare the bytes with it.
+ *
+ * Jumps to labels are short, with an 8 bit displacement, until the layout shows that they do not
+ * reach, and each pass of widening can only push other targets further, so it ends. Calls are
+ * always near.
+ */
+
+/* Registers in the order of their numbers in instructions. */
+char* reg64_names[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                       "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+char* reg8_names[] = {"al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+                      "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+#define RSP 4
+#define RBP 5
+
+/* Condition codes of `j<cc>` and `set<cc>`, by their numbers. */
+char* cond_names[] = {"o", "no", "b", "ae", "e", "ne", "be", "a",
+                      "s", "ns", "p", "np", "l", "ge", "le", "g"};
+
+/* Operators by the extension in the ModRM reg field of their group: by an immediate with 0x83 and
+ * 0x81, on one operand with 0xf7, and shifts with 0xd1, 0xc1 and 0xd3. */
+char* alu_names[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+char* unary_names[] = {"", "", "not", "neg", "mul", "imul", "div", "idiv"};
+char* shift_names[] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "", "sar"};
+
+int find_name(char** names, int count, char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Returns the condition code of `op` when it is `prefix` followed by a condition, or -1. */
+int condition(char* op, char* prefix) {
+    int len = strlen(prefix);
+    if (strncmp(op, prefix, len) != 0) {
+        return -1;
+    }
+    return find_name(cond_names, 16, op + len);
+}
+
+bool fits8(long val) { return val == (signed char)val; }
+
+bool fits32(long val) { return val == (int)val; }
+
+int reg_number(char* name, int len) {
+    for (int i = 0; i < 16; i++) {
+        if ((int)strlen(reg64_names[i]) == len && strncmp(reg64_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Parses the inside of the brackets of `[base + index * scale + disp]`, with its parts in any
+ * order and each optional but the base. */
+Operand parse_memory(char* text) {
+    Operand opnd = {OPND_MEM, -1, -1, 1, 0, NULL};
+    char* p = text;
+    int sign = 1;
+    while (*p && *p != ']') {
+        if (*p == '+' || *p == '-') {
+            sign = *p == '-' ? -1 : 1;
+            p++;
+            continue;
+        }
+        if (isdigit(*p)) {
+            opnd.val += sign * strtol(p, &p, 10);
+            continue;
+        }
+        int len = 0;
+        while (isalnum(p[len])) {
+            len++;
+        }
+        int reg = reg_number(p, len);
+        if (reg < 0) {
+            error("unknown register in memory operand: [%s", text);
+        }
+        p += len;
+        if (*p == '*') {
+            p++;
+            opnd.index = reg;
+            opnd.scale = strtol(p, &p, 10);
+        } else if (opnd.reg < 0) {
+            opnd.reg = reg;
+        } else {
+            opnd.index = reg;
+        }
+    }
+    if (opnd.reg < 0 || opnd.index == RSP) {
+        error("cannot encode memory operand: [%s", text);
+    }
+    return opnd;
+}
+
+Operand parse_operand(char* text) {
+    /* The size is always 64 bits, which `qword ptr` only makes explicit. */
+    if (strncmp(text, "qword ptr ", 10) == 0) {
+        text += 10;
+    }
+    if (text[0] == '[') {
+        return parse_memory(text + 1);
+    }
+    Operand opnd = {OPND_REG, -1, -1, 1, 0, NULL};
+    if ((opnd.reg = find_name(reg64_names, 16, text)) >= 0) {
+        return opnd;
+    }
+    if ((opnd.reg = find_name(reg8_names, 16, text)) >= 0) {
+        opnd.kind = OPND_REG8;
+        return opnd;
+    }
+    if (isdigit(text[0]) || text[0] == '-') {
+        opnd.kind = OPND_IMM;
+        opnd.val = strtol(text, NULL, 10);
+        return opnd;
+    }
+    opnd.kind = OPND_LABEL;
+    opnd.label = text;
+    return opnd;
+}
+
+void put(Encoding* e, long byte) { e->bytes[e->len++] = byte & 0xff; }
+
+void put_imm(Encoding* e, long val, int size) {
+    for (int i = 0; i < size; i++) {
+        put(e, val >> (i * 8));
+    }
+}
+
+/* Puts `opcode`, one byte or two after 0x0f, with its prefix and the operands: `reg` in the reg
+ * field of ModRM, which is a register number or an opcode extension, and `rm`. */
+void put_modrm(Encoding* e, bool wide, int opcode, int reg, Operand* rm) {
+    int rex = 0x40 | wide << 3 | (reg >> 3) << 2 | rm->reg >> 3;
+    if (rm->kind == OPND_MEM && rm->index >= 0) {
+        rex |= (rm->index >> 3) << 1;
+    }
+    /* spl, bpl, sil and dil are ah, ch, dh and bh without a REX prefix. */
+    bool low_byte = rm->kind == OPND_REG8 && rm->reg >= RSP && rm->reg < 8;
+    if (rex != 0x40 || low_byte) {
+        put(e, rex);
+    }
+    if (opcode > 0xff) {
+        put(e, opcode >> 8);
+    }
+    put(e, opcode);
+
+    if (rm->kind != OPND_MEM) {
+        put(e, 0xc0 | (reg & 7) << 3 | (rm->reg & 7));
+        return;
+    }
+    /* A base of rbp or r13 without displacement means rip relative or no base, and a base of
+     * rsp or r12 means a SIB byte follows. */
+    int base = rm->reg & 7;
+    int mod = rm->val == 0 && base != RBP ? 0 : fits8(rm->val) ? 1 : 2;
+    bool sib = rm->index >= 0 || base == RSP;
+    put(e, mod << 6 | (reg & 7) << 3 | (sib ? RSP : base));
+    if (sib) {
+        int scale = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+        int index = rm->index >= 0 ? rm->index & 7 : RSP;
+        put(e, scale << 6 | index << 3 | base);
+    }
+    put_imm(e, rm->val, mod == 1 ? 1 : mod == 2 ? 4 : 0);
+}
+
+/* Puts `op` `dst`, `src` of the operators of alu_names, which `ext` is the index of. */
+void put_alu(Encoding* e, int ext, Operand* dst, Operand* src) {
+    int base = ext << 3;
+    if (src->kind == OPND_REG) {
+        put_modrm(e, true, base + 1, src->reg, dst);
+    } else if (src->kind == OPND_MEM) {
+        put_modrm(e, true, base + 3, dst->reg, src);
+    } else if (fits8(src->val)) {
+        put_modrm(e, true, 0x83, ext, dst);
+        put_imm(e, src->val, 1);
+    } else if (dst->kind == OPND_REG && dst->reg == 0) {
+        /* rax has a form without ModRM. */
+        put(e, 0x48);
+        put(e, base + 5);
+        put_imm(e, src->val, 4);
+    } else {
+        put_modrm(e, true, 0x81, ext, dst);
+        put_imm(e, src->val, 4);
+    }
+}
+
+void put_mov(Encoding* e, Operand* dst, Operand* src) {
+    if (src->kind == OPND_REG) {
+        put_modrm(e, true, 0x89, src->reg, dst);
+    } else if (src->kind == OPND_MEM) {
+        put_modrm(e, true, 0x8b, dst->reg, src);
+    } else if (fits32(src->val) || dst->kind == OPND_MEM) {
+        put_modrm(e, true, 0xc7, 0, dst);
+        put_imm(e, src->val, 4);
+    } else {
+        /* `movabs` takes the whole 64 bits. */
+        put(e, 0x48 | dst->reg >> 3);
+        put(e, 0xb8 + (dst->reg & 7));
+        put_imm(e, src->val, 8);
+    }
+}
+
+/* Puts `push` or `pop` of `opnd`, which are 64 bit without REX.W. */
+void put_stack(Encoding* e, bool push, Operand* opnd) {
+    if (opnd->kind == OPND_REG) {
+        if (opnd->reg >= 8) {
+            put(e, 0x41);
+        }
+        put(e, (push ? 0x50 : 0x58) + (opnd->reg & 7));
+    } else if (opnd->kind == OPND_MEM) {
+        put_modrm(e, false, push ? 0xff : 0x8f, push ? 6 : 0, opnd);
+    } else if (push && fits8(opnd->val)) {
+        put(e, 0x6a);
+        put_imm(e, opnd->val, 1);
+    } else if (push) {
+        put(e, 0x68);
+        put_imm(e, opnd->val, 4);
+    } else {
+        error("cannot encode: pop of an immediate");
+    }
+}
+
+/* Kinds of the transfers to labels besides `j<cc>`, whose kind is its condition code. */
+#define NO_JUMP -1
+#define JMP -2
+#define CALL -3
+
+/* Puts the transfer of `kind` to `disp` bytes after its end, as a short one if `near` is false,
+ * which `call` never is. */
+void put_jump(Encoding* e, int kind, long disp, bool near) {
+    e->len = 0;
+    if (!near) {
+        put(e, kind == JMP ? 0xeb : 0x70 + kind);
+        put_imm(e, disp, 1);
+        return;
+    }
+    if (kind >= 0) {
+        put(e, 0x0f);
+    }
+    put(e, kind == JMP ? 0xe9 : kind == CALL ? 0xe8 : 0x80 + kind);
+    put_imm(e, disp, 4);
+}
+
+/* Size of a jump, see put_jump(). */
+int jump_size(int kind, bool near) { return near ? (kind >= 0 ? 6 : 5) : 2; }
+
+void encode_insn(Insn* insn, Encoding* e) {
+    char* op = insn->op;
+    Operand args[3];
+    for (int i = 0; i < insn->argc; i++) {
+        args[i] = parse_operand(insn->args[i]);
+    }
+    Operand* dst = &args[0];
+    Operand* src = &args[1];
+    e->len = 0;
+
+    int ext;
+    if (strcmp(op, "mov") == 0 && insn->argc == 2) {
+        put_mov(e, dst, src);
+    } else if ((ext = find_name(alu_names, 8, op)) >= 0 && insn->argc == 2) {
+        put_alu(e, ext, dst, src);
+    } else if ((ext = find_name(unary_names, 8, op)) >= 0 && insn->argc == 1) {
+        put_modrm(e, true, 0xf7, ext, dst);
+    } else if (strcmp(op, "imul") == 0 && insn->argc == 2 && src->kind != OPND_IMM) {
+        put_modrm(e, true, 0x0faf, dst->reg, src);
+    } else if (strcmp(op, "imul") == 0) {
+        /* `imul r, imm` is `imul r, r, imm`. */
+        Operand* rm = insn->argc == 3 ? src : dst;
+        long imm = args[insn->argc - 1].val;
+        put_modrm(e, true, fits8(imm) ? 0x6b : 0x69, dst->reg, rm);
+        put_imm(e, imm, fits8(imm) ? 1 : 4);
+    } else if ((ext = find_name(shift_names, 8, op)) >= 0 && insn->argc == 2) {
+        if (src->kind == OPND_REG8) {
+            put_modrm(e, true, 0xd3, ext, dst);
+        } else if (src->val == 1) {
+            put_modrm(e, true, 0xd1, ext, dst);
+        } else {
+            put_modrm(e, true, 0xc1, ext, dst);
+            put_imm(e, src->val, 1);
+        }
+    } else if (strcmp(op, "lea") == 0) {
+        put_modrm(e, true, 0x8d, dst->reg, src);
+    } else if (strcmp(op, "test") == 0) {
+        put_modrm(e, true, 0x85, src->reg, dst);
+    } else if (strcmp(op, "movzb") == 0) {
+        put_modrm(e, true, 0x0fb6, dst->reg, src);
+    } else if (condition(op, "set") >= 0) {
+        put_modrm(e, false, 0x0f90 + condition(op, "set"), 0, dst);
+    } else if (strcmp(op, "push") == 0 || strcmp(op, "pop") == 0) {
+        put_stack(e, op[1] == 'u', dst);
+    } else if (strcmp(op, "cqo") == 0) {
+        put(e, 0x48);
+        put(e, 0x99);
+    } else if (strcmp(op, "ret") == 0) {
+        put(e, 0xc3);
+    } else if (strcmp(op, "syscall") == 0) {
+        put(e, 0x0f);
+        put(e, 0x05);
+    } else {
+        error("cannot encode: %s", op);
+    }
+}
+
+/* Returns the kind of transfer to a label of `insn`, or NO_JUMP. */
+int jump_kind(Insn* insn) {
+    if (!insn->op || insn->argc != 1 || parse_operand(insn->args[0]).kind != OPND_LABEL) {
+        return NO_JUMP;
+    }
+    if (strcmp(insn->op, "jmp") == 0) {
+        return JMP;
+    }
+    if (strcmp(insn->op, "call") == 0) {
+        return CALL;
+    }
+    int cc = condition(insn->op, "j");
+    return cc >= 0 ? cc : NO_JUMP;
+}
+
+Label* find_label(MachineCode* code, char* name) {
+    for (int i = 0; i < code->labels->len; i++) {
+        Label* label = code->labels->data[i];
+        if (strcmp(label->name, name) == 0) {
+            return label;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the label of the line `text` if it is a label, or NULL if it is a directive. */
+Label* parse_label(char* text) {
+    int len = strlen(text);
+    if (len == 0 || (text[0] == '.' && text[len - 1] != ':')) {
+        return NULL;
+    }
+    if (text[len - 1] != ':') {
+        error("cannot encode: %s", text);
+    }
+    Label* label = calloc(1, sizeof(Label));
+    label->name = calloc(1, len);
+    memcpy(label->name, text, len - 1);
+    return label;
+}
+
+/*
+ * Returns the machine code of `insns`, where labels and `.global` are the only directives that
+ * matter. Transfers to labels that are not defined get a near displacement of 0, to be relocated
+ * to the symbol of their name.
+ */
+MachineCode* encode(Vector* insns) {
+    MachineCode* code = calloc(1, sizeof(MachineCode));
+    code->labels = create_vector();
+    code->relocs = create_vector();
+    Vector* globals = create_vector();
+
+    int count = insns->len;
+    Encoding* encodings = calloc(count, sizeof(Encoding));
+    int* kinds = calloc(count, sizeof(int));
+    bool* near = calloc(count, sizeof(bool));
+    Label** labels = calloc(count, sizeof(Label*));
+    for (int i = 0; i < count; i++) {
+        Insn* insn = insns->data[i];
+        kinds[i] = jump_kind(insn);
+        near[i] = kinds[i] == CALL;
+        if (insn->op && kinds[i] == NO_JUMP) {
+            encode_insn(insn, &encodings[i]);
+        } else if (!insn->op && strncmp(insn->text, ".global ", 8) == 0) {
+            vec_push(globals, insn->text + 8);
+        } else if (!insn->op && (labels[i] = parse_label(insn->text))) {
+            vec_push(code->labels, labels[i]);
+        }
+    }
+
+    /* Offsets are laid out again until no short jump is out of reach. */
+    Label** targets = calloc(count, sizeof(Label*));
+    for (int i = 0; i < count; i++) {
+        if (kinds[i] != NO_JUMP) {
+            targets[i] = find_label(code, ((Insn*)insns->data[i])->args[0]);
+            near[i] = near[i] || !targets[i];
+        }
+    }
+    int* offsets = calloc(count + 1, sizeof(int));
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 0; i < count; i++) {
+            if (labels[i]) {
+                labels[i]->offset = offsets[i];
+            }
+            int size = kinds[i] == NO_JUMP ? encodings[i].len : jump_size(kinds[i], near[i]);
+            offsets[i + 1] = offsets[i] + size;
+        }
+        for (int i = 0; i < count; i++) {
+            if (targets[i] && !near[i] && !fits8(targets[i]->offset - offsets[i + 1])) {
+                near[i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    code->len = offsets[count];
+    code->bytes = malloc(code->len + 1);
+    for (int i = 0; i < count; i++) {
+        if (kinds[i] != NO_JUMP && targets[i]) {
+            put_jump(&encodings[i], kinds[i], targets[i]->offset - offsets[i + 1], near[i]);
+        } else if (kinds[i] != NO_JUMP) {
+            put_jump(&encodings[i], kinds[i], 0, true);
+            /* The displacement is from the end of the instruction, 4 bytes after its field. */
+            Reloc* reloc = calloc(1, sizeof(Reloc));
+            reloc->symbol = ((Insn*)insns->data[i])->args[0];
+            reloc->offset = offsets[i + 1] - 4;
+            reloc->addend = -4;
+            vec_push(code->relocs, reloc);
+        }
+        memcpy(code->bytes + offsets[i], encodings[i].bytes, encodings[i].len);
+    }
+    for (int i = 0; i < globals->len; i++) {
+        Label* label = find_label(code, globals->data[i]);
+        if (label) {
+            label->global = true;
+        }
+    }
+
+    free(encodings);
+    free(kinds);
+    free(near);
+    free(labels);
+    free(targets);
+    free(offsets);
+    return code;
+}
+
+/* Writes the bytes of `code` as they are. */
+void write_code(MachineCode* code, FILE* out) { fwrite(code->bytes, 1, code->len, out); }
@@ -0,0 +1,67 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "insn.h"
+#include "vector.h"
+
+/* Bytes of one instruction, which are 15 at most on x86-64. */
+typedef struct {
+    unsigned char bytes[15];
+    int len;
+} Encoding;
+
+/* Kind of an operand, as written in the assembly. */
+typedef enum {
+    OPND_REG,   // 64 bit register.
+    OPND_REG8,  // Low byte of a register.
+    OPND_IMM,   // Immediate.
+    OPND_MEM,   // [base + index * scale + disp]
+    OPND_LABEL, // Jump target.
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    int reg;   // Number of the register, or of the base register of OPND_MEM.
+    int index; // Number of the index register of OPND_MEM, or -1.
+    int scale;
+    long val; // Value of OPND_IMM, or displacement of OPND_MEM.
+    char* label;
+} Operand;
+
+/* Label defined by a line `name:`, at `offset` bytes from the start of the code. */
+typedef struct {
+    char* name;
+    int offset;
+    bool global; // Named by a `.global` directive.
+} Label;
+
+/* 32 bit displacement at `offset` in the code, to be set to `symbol` + `addend` - its address
+ * by the linker. */
+typedef struct {
+    char* symbol;
+    int offset;
+    long addend;
+} Reloc;
+
+/* Machine code of a list of instructions. */
+typedef struct {
+    unsigned char* bytes;
+    int len;
+    Vector* labels;
+    Vector* relocs;
+} MachineCode;
+
+Operand parse_operand(char* text);
+
+void encode_insn(Insn* insn, Encoding* e);
+
+MachineCode* encode(Vector* insns);
+
+Label* find_label(MachineCode* code, char* name);
+
+void write_code(MachineCode* code, FILE* out);
+
+#endif // !ENCODE_H
@@ -1,6 +1,24 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+
+/* Maximum number of diagnostics before giving up, 0 for no limit. */
+int error_limit = 20;
+
+/* Number of diagnostics reported by error_at. */
+int error_count = 0;
+
+/* Name of the input shown by diagnostics. */
+char* input_name = "<input>";
+
+/* Offsets of the first character of each line of `indexed_input`, in increasing order. */
+char* indexed_input;
+int* line_starts;
+int line_count;
+int line_capacity;
 
 void error(char* fmt, ...) {
     va_list ap;
@@ -10,15 +28,93 @@ void error(char* fmt, ...) {
     exit(1);
 }
 
+/* Starts a new line index of `user_input`, whose first line starts at offset 0. */
+void start_line_index(char* user_input) {
+    indexed_input = user_input;
+    line_count = 0;
+    add_line_start(user_input, user_input);
+}
+
+/* Records that a line starts at `location`. Lines already indexed are ignored. */
+void add_line_start(char* user_input, char* location) {
+    int offset = location - user_input;
+    if (user_input != indexed_input || (line_count > 0 && offset <= line_starts[line_count - 1])) {
+        return;
+    }
+    if (line_count == line_capacity) {
+        line_capacity = line_capacity ? line_capacity * 2 : 64;
+        line_starts = realloc(line_starts, sizeof(int) * line_capacity);
+        if (!line_starts) {
+            error("out of memory.");
+        }
+    }
+    line_starts[line_count++] = offset;
+}
+
+/* Forgets the line index, so that the next diagnostic indexes every line of its input. Sources
+ * tokenized only in parts drop it instead of indexing lines that no diagnostic may need. */
+void drop_line_index() { indexed_input = NULL; }
+
+/* Indexes every line of `user_input`, for sources that are not tokenized in one go. */
+void index_lines(char* user_input) {
+    start_line_index(user_input);
+    for (char* p = strchr(user_input, '\n'); p; p = strchr(p + 1, '\n')) {
+        add_line_start(user_input, p + 1);
+    }
+}
+
+/* Returns the 0-based line containing `offset` by binary search. */
+int find_line(int offset) {
+    int low = 0;
+    int high = line_count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (line_starts[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+/* Reports a diagnostic and returns, so that the caller can recover and find more errors. */
+/* Only the line of `location` is printed, cut around it when the line is very long. */
 void error_at(char* user_input, char* location, char* fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
 
-    int position = location - user_input;
-    fprintf(stderr, "%s\n", user_input);
-    fprintf(stderr, "%*s", position, " ");
-    fprintf(stderr, "^ ");
+    if (user_input != indexed_input) {
+        index_lines(user_input);
+    }
+    int offset = location - user_input;
+    int line = find_line(offset);
+    char* begin = user_input + line_starts[line];
+    /* The tokenizer reports errors before indexing the lines after `location`. */
+    char* end = line + 1 < line_count ? user_input + line_starts[line + 1] - 1
+                                      : location + strcspn(location, "\n");
+
+    fprintf(stderr, "%s:%d:%d: ", input_name, line + 1, (int)(location - begin) + 1);
     vfprintf(stderr, fmt, ap);
     fprintf(stderr, "\n");
-    exit(1);
+
+    /* Show at most this many characters on each side of the location. */
+    int width = 60;
+    char* from = location - begin > width ? location - width : begin;
+    char* to = end - location > width ? location + width : end;
+    fprintf(stderr, "%s%.*s%s\n", from > begin ? "..." : "", (int)(to - from), from,
+            to < end ? "..." : "");
+    /* Tabs are copied so the caret lines up with the text. */
+    if (from > begin) {
+        fprintf(stderr, "   ");
+    }
+    for (char* p = from; p < location; p++) {
+        fputc(*p == '\t' ? '\t' : ' ', stderr);
+    }
+    fprintf(stderr, "^\n");
+
+    error_count++;
+    if (error_limit && error_count >= error_limit) {
+        error("too many errors emitted, stopping now.");
+    }
 }
@@ -1,8 +1,24 @@
 #ifndef ERROR_AT_H
 #define ERROR_AT_H
 
+extern int error_limit;
+
+extern int error_count;
+
+extern char* input_name;
+
 void error(char* fmt, ...);
 
+void start_line_index(char* user_input);
+
+void add_line_start(char* user_input, char* location);
+
+void drop_line_index();
+
+void index_lines(char* user_input);
+
+int find_line(int offset);
+
 void error_at(char* user_input, char* location, char* fmt, ...);
 
 #endif // !ERROR_AT_H
@@ -0,0 +1,102 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "eval.h"
+#include "fold.h"
+#include "map.h"
+#include "node.h"
+#include "vector.h"
+
+/*
+ * Compile-time evaluation.
+ *
+ * Programs have no input, so running one gives the same result every time. The statements are
+ * interpreted here like the generated code runs them, each node in post order on a value stack,
+ * and each node costs one unit of fuel. Evaluation gives up when the fuel runs out, when a
+ * variable is read before it is stored, since its stack slot holds garbage, and when a division
+ * traps, so that the trap still happens at runtime.
+ */
+
+/* Runs one statement, and returns false if evaluation gave up. */
+bool eval_statement(Node* root, Map* vars, Vector* stack, long* fuel, long* val) {
+    Vector* nodes = postorder_nodes(root);
+    /* Variables assigned to are not read. */
+    Map* targets = create_map();
+    for (int i = 0; i < nodes->len; i++) {
+        Node* node = nodes->data[i];
+        if (node->kind == ND_ASSIGN) {
+            map_put(targets, node->lhs, node);
+        }
+    }
+
+    bool done = true;
+    stack->len = 0;
+    for (int i = 0; done && i < nodes->len; i++) {
+        Node* node = nodes->data[i];
+        if (--*fuel < 0) {
+            done = false;
+            break;
+        }
+        long* cell;
+        switch (node->kind) {
+        case ND_NUM:
+            vec_push(stack, (void*)node->val);
+            break;
+        case ND_LVAR:
+            if (map_contains(targets, node)) {
+                break;
+            }
+            cell = map_get(vars, node->lvar);
+            if (!cell) {
+                done = false;
+                break;
+            }
+            vec_push(stack, (void*)*cell);
+            break;
+        case ND_ASSIGN:
+            cell = map_get(vars, node->lhs->lvar);
+            if (!cell) {
+                cell = calloc(1, sizeof(long));
+                map_put(vars, node->lhs->lvar, cell);
+            }
+            *cell = (long)vec_last(stack);
+            break;
+        case ND_RETURN:
+            break;
+        default: {
+            long rhs = (long)vec_pop(stack);
+            long lhs = (long)vec_pop(stack);
+            long result;
+            if (!eval_binary(node->kind, lhs, rhs, &result)) {
+                done = false;
+                break;
+            }
+            vec_push(stack, (void*)result);
+            break;
+        }
+        }
+    }
+
+    if (done) {
+        *val = (long)vec_last(stack);
+    }
+    free(nodes->data);
+    free(nodes);
+    return done;
+}
+
+bool evaluate_program(Vector* code, long fuel, long* val) {
+    Map* vars = create_map();
+    Vector* stack = create_vector();
+    bool done = code->len > 0;
+    for (int i = 0; done && i < code->len; i++) {
+        Node* node = code->data[i];
+        done = eval_statement(node, vars, stack, &fuel, val);
+        if (node->kind == ND_RETURN) {
+            break;
+        }
+    }
+    free(stack->data);
+    free(stack);
+    return done;
+}
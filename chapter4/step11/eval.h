@@ -0,0 +1,12 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <stdbool.h>
+
+#include "vector.h"
+
+/* Runs `code` with at most `fuel` node evaluations, and sets `val` to the value it returns.
+ * Returns false if the program could not be evaluated. */
+bool evaluate_program(Vector* code, long fuel, long* val);
+
+#endif // !EVAL_H
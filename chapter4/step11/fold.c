@@ -0,0 +1,84 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fold.h"
+#include "node.h"
+#include "vector.h"
+
+/*
+ * Constant folding.
+ *
+ * Subtrees made only of ND_NUM are evaluated at compile time with the same 64 bit two's
+ * complement arithmetic the generated code does, and replaced by one ND_NUM. Nodes are visited
+ * in post order, so a parent sees its children already folded.
+ */
+
+/* Computes `lhs` `kind` `rhs` as the generated code would, and returns false if it traps. */
+bool eval_binary(NodeKind kind, long lhs, long rhs, long* val) {
+    /* Wrap around through unsigned arithmetic, where overflow is defined. */
+    uint64_t a = lhs;
+    uint64_t b = rhs;
+    switch (kind) {
+    case ND_ADD:
+        *val = (int64_t)(a + b);
+        return true;
+    case ND_SUB:
+        *val = (int64_t)(a - b);
+        return true;
+    case ND_MUL:
+        *val = (int64_t)(a * b);
+        return true;
+    case ND_SHL:
+        /* `shl` masks the count to 6 bits. */
+        *val = (int64_t)(a << (b & 63));
+        return true;
+    case ND_DIV:
+        /* `idiv` raises #DE for these, which is left to happen at runtime. */
+        if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {
+            return false;
+        }
+        *val = lhs / rhs;
+        return true;
+    case ND_EQ:
+        *val = lhs == rhs;
+        return true;
+    case ND_NEQ:
+        *val = lhs != rhs;
+        return true;
+    case ND_LT:
+        *val = lhs < rhs;
+        return true;
+    case ND_LTE:
+        *val = lhs <= rhs;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Replaces `node` by its value if both operands are ND_NUM, and returns true if it did. */
+bool fold_node(Node* node) {
+    long val;
+    /* ND_ASSIGN and ND_RETURN have effects, and ND_LVAR is not known here. */
+    if (!node->lhs || !node->rhs || node->lhs->kind != ND_NUM || node->rhs->kind != ND_NUM ||
+        node->kind == ND_ASSIGN || !eval_binary(node->kind, node->lhs->val, node->rhs->val, &val)) {
+        return false;
+    }
+    node->kind = ND_NUM;
+    node->val = val;
+    node->lhs = NULL;
+    node->rhs = NULL;
+    return true;
+}
+
+void fold_constants(Vector* code) {
+    for (int i = 0; i < code->len; i++) {
+        Vector* nodes = postorder_nodes(code->data[i]);
+        for (int j = 0; j < nodes->len; j++) {
+            fold_node(nodes->data[j]);
+        }
+        free(nodes->data);
+        free(nodes);
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdbool.h>
+
+#include "node.h"
+#include "vector.h"
+
+bool eval_binary(NodeKind kind, long lhs, long rhs, long* val);
+
+bool fold_node(Node* node);
+
+void fold_constants(Vector* code);
+
+#endif // !FOLD_H
@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "gvn.h"
+#include "ir.h"
+#include "vector.h"
+
+/*
+ * Global value numbering.
+ *
+ * In SSA form a register never changes, so two instructions with the same operator and the same
+ * operand registers compute the same value, and the second can use the register of the first.
+ * An assignment to a variable makes a new register, so it already kills every value computed
+ * from the old one. Operands of commutative operators are put in register order first, so that
+ * `a+b` and `b+a` are found equal, and constants last, where the backend looks for them.
+ * Operators that know their result when both operands are the same value, such as `x-x` and
+ * `x==x`, become constants.
+ *
+ * A value is reused where the block of its instruction dominates. Blocks with a single
+ * predecessor start with the table of that predecessor, and the others with an empty table.
+ */
+
+/* Returns true if `ir` computes a value from its operands only. */
+bool numbered(Ir* ir) { return ir->kind == IR_IMM || ir->kind == IR_BIN; }
+
+/* Operator of `ir`, which is only meaningful for IR_BIN. */
+int expr_op(Ir* ir) { return ir->kind == IR_BIN ? (int)ir->op : -1; }
+
+uint64_t hash_expr(Ir* ir) {
+    uint64_t fields[] = {ir->kind, expr_op(ir), ir->lhs, ir->rhs, ir->val};
+    /* FNV-1a of the fields. */
+    uint64_t hash = 14695981039346656037ull;
+    unsigned char* bytes = (unsigned char*)fields;
+    for (size_t i = 0; i < sizeof(fields); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Replaces `ir` by its constant value if both its operands are the same register. */
+void fold_same_operands(Ir* ir) {
+    if (ir->kind != IR_BIN || ir->lhs != ir->rhs) {
+        return;
+    }
+    switch (ir->op) {
+    case ND_SUB:
+    case ND_NEQ:
+    case ND_LT:
+        ir->val = 0;
+        break;
+    case ND_EQ:
+    case ND_LTE:
+        ir->val = 1;
+        break;
+    default:
+        return;
+    }
+    ir->kind = IR_IMM;
+    ir->lhs = 0;
+    ir->rhs = 0;
+}
+
+/* Rank of register `reg` in the order of commutative operands. */
+long operand_rank(Ir** defs, int reg) {
+    bool imm = defs[reg] && defs[reg]->kind == IR_IMM;
+    return (long)imm << 32 | reg;
+}
+
+bool same_expr(Ir* a, Ir* b) {
+    return a->kind == b->kind && expr_op(a) == expr_op(b) && a->lhs == b->lhs &&
+           a->rhs == b->rhs && a->val == b->val;
+}
+
+ExprTable* create_expr_table(int capacity) {
+    ExprTable* table = calloc(1, sizeof(ExprTable));
+    table->capacity = capacity;
+    table->slots = calloc(capacity, sizeof(Ir*));
+    return table;
+}
+
+ExprTable* copy_expr_table(ExprTable* table) {
+    ExprTable* copy = create_expr_table(table->capacity);
+    memcpy(copy->slots, table->slots, sizeof(Ir*) * table->capacity);
+    copy->len = table->len;
+    return copy;
+}
+
+/* Index of the instruction computing the same value as `ir`, or of the slot to insert it in. */
+int find_expr(ExprTable* table, Ir* ir) {
+    int i = hash_expr(ir) & (table->capacity - 1);
+    while (table->slots[i] && !same_expr(table->slots[i], ir)) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return i;
+}
+
+void insert_expr(ExprTable* table, Ir* ir) {
+    if (table->len * 2 >= table->capacity) {
+        Ir** slots = table->slots;
+        int capacity = table->capacity;
+        table->capacity *= 2;
+        table->slots = calloc(table->capacity, sizeof(Ir*));
+        if (!table->slots) {
+            error("out of memory.");
+        }
+        for (int i = 0; i < capacity; i++) {
+            if (slots[i]) {
+                table->slots[find_expr(table, slots[i])] = slots[i];
+            }
+        }
+        free(slots);
+    }
+    table->slots[find_expr(table, ir)] = ir;
+    table->len++;
+}
+
+void number_values(IrProgram* prog) {
+    /* Register that replaces each register, itself if none. */
+    int* leader = calloc(prog->reg_count + 1, sizeof(int));
+    for (int i = 0; i <= prog->reg_count; i++) {
+        leader[i] = i;
+    }
+    /* Instruction defining each leader. */
+    Ir** defs = calloc(prog->reg_count + 1, sizeof(Ir*));
+    ExprTable** tables = calloc(prog->blocks->len, sizeof(ExprTable*));
+
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        ExprTable* table = block->preds->len == 1
+                               ? copy_expr_table(tables[((Block*)block->preds->data[0])->id])
+                               : create_expr_table(16);
+        tables[i] = table;
+
+        int len = 0;
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            ir->lhs = leader[ir->lhs];
+            ir->rhs = leader[ir->rhs];
+            for (int k = 0; ir->args && k < ir->args->len; k++) {
+                ir->args->data[k] = (void*)(long)leader[(int)(long)ir->args->data[k]];
+            }
+            if (ir->kind == IR_BIN && is_commutative(ir->op) &&
+                operand_rank(defs, ir->lhs) > operand_rank(defs, ir->rhs)) {
+                int lhs = ir->lhs;
+                ir->lhs = ir->rhs;
+                ir->rhs = lhs;
+            }
+            fold_same_operands(ir);
+            if (numbered(ir)) {
+                Ir* same = table->slots[find_expr(table, ir)];
+                if (same) {
+                    leader[ir->dst] = same->dst;
+                    continue;
+                }
+                insert_expr(table, ir);
+            }
+            if (ir->dst) {
+                defs[ir->dst] = ir;
+            }
+            block->irs->data[len++] = ir;
+        }
+        block->irs->len = len;
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include "ir.h"
+
+/* Hash set of instructions by operator and operands, with open addressing. */
+typedef struct {
+    Ir** slots;
+    int capacity;
+    int len;
+} ExprTable;
+
+void number_values(IrProgram* prog);
+
+#endif // !GVN_H
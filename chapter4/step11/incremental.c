@@ -0,0 +1,291 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "error.h"
+#include "incremental.h"
+#include "insn.h"
+#include "node.h"
+#include "select.h"
+#include "tokenizer.h"
+#include "vector.h"
+
+/*
+ * Incremental parsing.
+ *
+ * The source is split into spans, one per statement, which cover it without gaps. On update,
+ * the common prefix and suffix of the old and new sources are skipped, and only the spans that
+ * overlap the edited bytes are tokenized and parsed again. Spans after the edit are kept with
+ * their ASTs and only moved by the size difference.
+ *
+ * Statements are independent apart from the `locals` table, so each variable counts its
+ * ND_LVAR nodes and is removed with the last statement using it.
+ *
+ * At -O0 the code of each statement depends only on its AST, the frame and whether it is the
+ * last one, so each span also keeps its code, and generate_incremental() makes again only that of
+ * new spans and of those whose frame or position changed.
+ */
+
+IncrementalParser* create_incremental_parser() {
+    IncrementalParser* parser = calloc(1, sizeof(IncrementalParser));
+    parser->source = calloc(1, sizeof(char));
+    parser->spans = create_vector();
+    parser->free_slots = create_vector();
+    return parser;
+}
+
+Span* get_span(IncrementalParser* parser, int i) { return parser->spans->data[i]; }
+
+/* Return true if the last token in `source` from `begin` to `end` is `;`. */
+bool ends_statement(char* source, int begin, int end) {
+    while (end > begin && isspace(source[end - 1])) {
+        end--;
+    }
+    return end > begin && source[end - 1] == ';';
+}
+
+/* Parses statements from `begin` to `end` of `source` and pushes their spans to `spans`. */
+void parse_spans(char* source, int begin, int end, Vector* spans) {
+    Token* token = tokenize_range(source, source + begin, source + end);
+    int position = begin;
+    while (!at_eof(token)) {
+        int errors = error_count;
+        Node* node = statement(source, &token);
+        if (!node) {
+            synchronize(&token);
+        }
+
+        Span* span = calloc(1, sizeof(Span));
+        span->begin = position;
+        span->end = token->str - source;
+        span->node = node;
+        span->errors = error_count - errors;
+        span->lvars = create_vector();
+        if (node) {
+            collect_lvars(node, span->lvars);
+        }
+        vec_push(spans, span);
+        position = span->end;
+    }
+}
+
+/* Removes variables no longer used by any statement and gives stack slots to new ones. */
+void update_locals(IncrementalParser* parser) {
+    LVar** link = &locals;
+    while (*link) {
+        LVar* var = *link;
+        if (var->refs == 0) {
+            if (var->offset) {
+                vec_push(parser->free_slots, (void*)(intptr_t)var->offset);
+            }
+            *link = var->next;
+            continue;
+        }
+        if (!var->offset) {
+            if (parser->free_slots->len > 0) {
+                var->offset = (intptr_t)vec_pop(parser->free_slots);
+            } else {
+                parser->frame_size += 8;
+                var->offset = parser->frame_size;
+            }
+        }
+        link = &var->next;
+    }
+}
+
+void update_source(IncrementalParser* parser, char* source) {
+    char* old = parser->source;
+    int old_len = parser->len;
+    int len = strlen(source);
+
+    /* The edit replaced old[prefix, old_len - suffix) with source[prefix, len - suffix). */
+    int prefix = 0;
+    while (prefix < old_len && prefix < len && old[prefix] == source[prefix]) {
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < old_len - prefix && suffix < len - prefix &&
+           old[old_len - 1 - suffix] == source[len - 1 - suffix]) {
+        suffix++;
+    }
+    int delta = len - old_len;
+
+    /* Spans [first, last) overlap the edit. Only the final span can lack its `;`, and then
+     * text appended to it belongs to it. */
+    Vector* spans = parser->spans;
+    int first = 0;
+    while (first < spans->len && get_span(parser, first)->end <= prefix) {
+        first++;
+    }
+    if (first == spans->len && first > 0 &&
+        !ends_statement(old, get_span(parser, first - 1)->begin, old_len)) {
+        first--;
+    }
+    int last = first;
+    while (last < spans->len && get_span(parser, last)->begin < old_len - suffix) {
+        last++;
+    }
+
+    /* Reparse from a statement boundary up to one, taking in following spans until the edited
+     * text is closed by `;`. */
+    int begin = first < spans->len ? get_span(parser, first)->begin : old_len;
+    if (spans->len == 0) {
+        begin = 0;
+    }
+    int end = last < spans->len ? get_span(parser, last)->begin + delta : len;
+    while (last < spans->len && !ends_statement(source, begin, end)) {
+        end = get_span(parser, last)->end + delta;
+        last++;
+    }
+
+    /* Only a part is tokenized, so the lines are indexed by the first diagnostic if any. */
+    drop_line_index();
+    Vector* parsed = create_vector();
+    parse_spans(source, begin, end, parsed);
+    parser->reparsed = parsed->len;
+
+    /* Swap the spans and keep variable reference counts. */
+    for (int i = first; i < last; i++) {
+        Span* span = get_span(parser, i);
+        for (int j = 0; j < span->lvars->len; j++) {
+            ((LVar*)span->lvars->data[j])->refs--;
+        }
+        parser->errors -= span->errors;
+    }
+    for (int i = 0; i < parsed->len; i++) {
+        Span* span = parsed->data[i];
+        for (int j = 0; j < span->lvars->len; j++) {
+            ((LVar*)span->lvars->data[j])->refs++;
+        }
+        parser->errors += span->errors;
+    }
+
+    Vector* updated = create_vector();
+    for (int i = 0; i < first; i++) {
+        vec_push(updated, get_span(parser, i));
+    }
+    for (int i = 0; i < parsed->len; i++) {
+        vec_push(updated, parsed->data[i]);
+    }
+    for (int i = last; i < spans->len; i++) {
+        Span* span = get_span(parser, i);
+        span->begin += delta;
+        span->end += delta;
+        vec_push(updated, span);
+    }
+    /* Whitespace without any token still has to belong to a span. */
+    if (parsed->len == 0 && begin < end) {
+        if (last < spans->len) {
+            get_span(parser, last)->begin = begin;
+        } else if (first > 0) {
+            get_span(parser, first - 1)->end = end;
+        }
+    }
+    free(spans->data);
+    free(spans);
+    parser->spans = updated;
+    update_locals(parser);
+
+    free(parser->source);
+    parser->source = calloc(len + 1, sizeof(char));
+    memcpy(parser->source, source, len);
+    parser->len = len;
+}
+
+/* Returns the statements of the current source, skipping the ones with syntax errors. */
+Vector* incremental_code(IncrementalParser* parser) {
+    Vector* code = create_vector();
+    for (int i = 0; i < parser->spans->len; i++) {
+        Span* span = get_span(parser, i);
+        if (span->node) {
+            vec_push(code, span->node);
+        }
+    }
+    return code;
+}
+
+/* Labels the expression of the statement of `span` for instruction selection. */
+Labels* label_span(Span* span) {
+    Node* node = span->node;
+    return label_tree(node->kind == ND_RETURN ? node->lhs : node);
+}
+
+/* Prints the assembly of the current source like generate_program(), with the code of the
+ * statements kept by their spans where it still applies. */
+void generate_incremental(IncrementalParser* parser, bool stack_machine) {
+    /* Nothing runs into the statements after a `return`. */
+    Vector* spans = create_vector();
+    for (int i = 0; i < parser->spans->len; i++) {
+        Span* span = get_span(parser, i);
+        if (span->node) {
+            vec_push(spans, span);
+            if (span->node->kind == ND_RETURN) {
+                break;
+            }
+        }
+    }
+
+    /* The frame is decided as in generate_program(), from the registers kept by the spans and
+     * the variables, which are the ones that the statements use. */
+    bool leaf = !stack_machine;
+    for (int i = 0; i < spans->len && leaf; i++) {
+        Span* span = spans->data[i];
+        if (!span->regs) {
+            span->labels = label_span(span);
+            span->regs = tree_registers(span->labels);
+        }
+        leaf = span->regs <= EXPR_REG_COUNT;
+    }
+    int size = 0;
+    for (LVar* var = locals; var; var = var->next) {
+        size = var->offset > size ? var->offset : size;
+    }
+    generate_header();
+    bool frame = generate_prologue(size, leaf);
+    shared_epilogue = frame;
+    bool jumped = false;
+
+    Vector* code = take_insns();
+    parser->regenerated = 0;
+    for (int i = 0; i < spans->len; i++) {
+        Span* span = spans->data[i];
+        bool last = i == spans->len - 1;
+        if (!span->insns || span->frame_reg != frame_reg || span->shared_epilogue != frame ||
+            span->last != last) {
+            if (!stack_machine && !span->labels) {
+                span->labels = label_span(span);
+            }
+            return_jumped = false;
+            generate_statement(span->node, span->labels, last);
+            if (span->labels) {
+                free_labels(span->labels);
+                span->labels = NULL;
+            }
+            span->insns = take_insns();
+            span->frame_reg = frame_reg;
+            span->shared_epilogue = frame;
+            span->last = last;
+            span->jumps = return_jumped;
+            parser->regenerated++;
+        }
+        for (int j = 0; j < span->insns->len; j++) {
+            vec_push(code, span->insns->data[j]);
+        }
+        jumped = jumped || span->jumps;
+    }
+    emit_insns(code);
+    free(code->data);
+    free(code);
+    free(spans->data);
+    free(spans);
+
+    /* Epilogue. */
+    return_jumped = jumped;
+    if (return_jumped) {
+        emit(RETURN_LABEL ":\n");
+    }
+    generate_frame_epilogue(frame);
+}
@@ -0,0 +1,47 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+
+#include "node.h"
+#include "select.h"
+#include "vector.h"
+
+/* Source text of one statement, from its first token to the first token of the next one. */
+typedef struct Span Span;
+struct Span {
+    int begin;
+    int end;
+    Node* node;           // NULL when the statement has a syntax error.
+    int errors;           // Number of errors reported while parsing it.
+    Vector* lvars;        // Variable of each ND_LVAR node in `node`.
+    int regs;             // Registers its expression needs, see tree_registers(), 0 until labeled.
+    Labels* labels;       // Labels of its expression, kept until its code is generated.
+    Vector* insns;        // Code generated at -O0, NULL until generated.
+    char* frame_reg;      // frame_reg that `insns` address the variables from.
+    bool shared_epilogue; // shared_epilogue when `insns` were generated.
+    bool last;            // `insns` return the value of the statement.
+    bool jumps;           // `insns` jump to RETURN_LABEL.
+};
+
+/* Keeps the statements of the previous source, so that only edited ones are parsed again. */
+typedef struct {
+    char* source;
+    int len;
+    Vector* spans;     // Spans covering the whole source in order.
+    int errors;        // Sum of the errors of all spans.
+    Vector* free_slots; // Stack offsets of removed variables, reused by new ones.
+    int frame_size;    // Largest stack offset given to a variable.
+    int reparsed;      // Number of statements parsed by the last update.
+    int regenerated;   // Number of statements generated by the last generate_incremental().
+} IncrementalParser;
+
+IncrementalParser* create_incremental_parser();
+
+void update_source(IncrementalParser* parser, char* source);
+
+Vector* incremental_code(IncrementalParser* parser);
+
+void generate_incremental(IncrementalParser* parser, bool stack_machine);
+
+#endif // !INCREMENTAL_H
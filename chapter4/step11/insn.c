@@ -0,0 +1,107 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "insn.h"
+#include "vector.h"
+
+/*
+ * Emitted assembly.
+ *
+ * Code generators emit their lines here instead of printing them, so that the peephole pass can
+ * rewrite the instructions before they are printed. Lines indented by two spaces are
+ * instructions, split into their mnemonic and operands, and the others are kept as text.
+ */
+
+/* Lines emitted since the last take_insns(). */
+Vector* insns;
+
+Insn* new_insn(char* op, char* dst, char* src) {
+    Insn* insn = calloc(1, sizeof(Insn));
+    insn->op = op;
+    if (dst) {
+        insn->args[insn->argc++] = dst;
+    }
+    if (src) {
+        insn->args[insn->argc++] = src;
+    }
+    return insn;
+}
+
+/* Splits `line`, which it takes, into an instruction, or keeps it as a label or directive. */
+Insn* parse_insn(char* line) {
+    Insn* insn = calloc(1, sizeof(Insn));
+    if (strncmp(line, "  ", 2) != 0) {
+        insn->text = line;
+        return insn;
+    }
+    char* p = line + 2;
+    insn->op = p;
+    p += strcspn(p, " ");
+    /* Operands follow a space or a comma, and have no comma themselves. */
+    while (*p) {
+        *p++ = '\0';
+        while (*p == ' ') {
+            p++;
+        }
+        if (insn->argc == 3) {
+            error("too many operands: %s", insn->op);
+        }
+        insn->args[insn->argc++] = p;
+        p += strcspn(p, ",");
+    }
+    return insn;
+}
+
+/* Emits a line of assembly, formatted by `fmt` like printf. */
+void emit(char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    char* line = malloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(line, len + 1, fmt, ap);
+    va_end(ap);
+    if (len > 0 && line[len - 1] == '\n') {
+        line[len - 1] = '\0';
+    }
+
+    if (!insns) {
+        insns = create_vector();
+    }
+    vec_push(insns, parse_insn(line));
+}
+
+/* Emits again the lines of `lines`, which were taken by take_insns(). */
+void emit_insns(Vector* lines) {
+    if (!insns) {
+        insns = create_vector();
+    }
+    for (int i = 0; i < lines->len; i++) {
+        vec_push(insns, lines->data[i]);
+    }
+}
+
+/* Returns the lines emitted so far, and starts a new list. */
+Vector* take_insns() {
+    Vector* taken = insns ? insns : create_vector();
+    insns = NULL;
+    return taken;
+}
+
+void print_insn(Insn* insn, FILE* out) {
+    if (!insn->op) {
+        fprintf(out, "%s\n", insn->text);
+        return;
+    }
+    fprintf(out, "  %s", insn->op);
+    for (int i = 0; i < insn->argc; i++) {
+        fprintf(out, "%s%s", i == 0 ? " " : ", ", insn->args[i]);
+    }
+    fprintf(out, "\n");
+}
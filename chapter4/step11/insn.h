@@ -0,0 +1,28 @@
+#ifndef INSN_H
+#define INSN_H
+
+#include <stdio.h>
+
+#include "vector.h"
+
+/* Line of assembly, an instruction or else a label or directive kept as it is. */
+typedef struct {
+    char* op; // Mnemonic of an instruction, NULL for a label or directive.
+    char* args[3];
+    int argc;
+    char* text; // Label or directive.
+} Insn;
+
+Insn* new_insn(char* op, char* dst, char* src);
+
+Insn* parse_insn(char* line);
+
+void emit(char* fmt, ...);
+
+void emit_insns(Vector* lines);
+
+Vector* take_insns();
+
+void print_insn(Insn* insn, FILE* out);
+
+#endif // !INSN_H
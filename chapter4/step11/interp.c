@@ -0,0 +1,323 @@
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "interp.h"
+#include "map.h"
+#include "node.h"
+#include "vector.h"
+
+/*
+ * Bytecode interpreter.
+ *
+ * The statements are lowered to code for a stack machine, each node in post order to one
+ * instruction like the generated code runs them, with an operand cell after OP_PUSH, OP_LOAD and
+ * OP_STORE. Arithmetic wraps around and divisions trap like `idiv`, so that the interpreter can
+ * be compared against the generated code.
+ *
+ * The threaded interpreter replaces each opcode by the address of its handler, and every handler
+ * ends with a jump to the next one. This spares the bounds check and the shared indirect jump of
+ * the switch, and gives each handler its own jump for the branch predictor to learn.
+ */
+
+typedef struct {
+    Vector* cells; // Cells as longs.
+    int ops;
+    int depth;
+    int max_depth;
+    int vars;
+} Lowering;
+
+void emit_op(Lowering* l, Opcode op, int pushes) {
+    vec_push(l->cells, (void*)(long)op);
+    l->ops++;
+    l->depth += pushes;
+    if (l->depth > l->max_depth) {
+        l->max_depth = l->depth;
+    }
+}
+
+/* Emits `op` with the operand `val`. */
+void emit_op_val(Lowering* l, Opcode op, int pushes, long val) {
+    emit_op(l, op, pushes);
+    vec_push(l->cells, (void*)val);
+}
+
+/* Returns the slot of `var`, whose offset is a positive multiple of 8 as given by
+ * assign_lvar_offsets(). */
+int var_index(Lowering* l, LVar* var) {
+    if (var->offset <= 0 || var->offset % 8 != 0) {
+        error("variable at offset %d has no bytecode slot.", var->offset);
+    }
+    int index = var->offset / 8 - 1;
+    if (index >= l->vars) {
+        l->vars = index + 1;
+    }
+    return index;
+}
+
+/* Lowers one expression in post order, from postorder_nodes() so that deep trees do not recurse. */
+void lower_expr(Lowering* l, Node* root) {
+    Vector* nodes = postorder_nodes(root);
+    /* Variables assigned to are stored, not loaded. */
+    Map* targets = assignment_targets(nodes);
+
+    for (int i = 0; i < nodes->len; i++) {
+        Node* node = nodes->data[i];
+        switch (node->kind) {
+        case ND_NUM:
+            emit_op_val(l, OP_PUSH, 1, node->val);
+            break;
+        case ND_LVAR:
+            if (!map_contains(targets, node)) {
+                emit_op_val(l, OP_LOAD, 1, var_index(l, node->lvar));
+            }
+            break;
+        case ND_ASSIGN:
+            emit_op_val(l, OP_STORE, 0, var_index(l, node->lhs->lvar));
+            break;
+        case ND_ADD:
+            emit_op(l, OP_ADD, -1);
+            break;
+        case ND_SUB:
+            emit_op(l, OP_SUB, -1);
+            break;
+        case ND_MUL:
+            emit_op(l, OP_MUL, -1);
+            break;
+        case ND_DIV:
+            emit_op(l, OP_DIV, -1);
+            break;
+        case ND_SHL:
+            emit_op(l, OP_SHL, -1);
+            break;
+        case ND_EQ:
+            emit_op(l, OP_EQ, -1);
+            break;
+        case ND_NEQ:
+            emit_op(l, OP_NEQ, -1);
+            break;
+        case ND_LT:
+            emit_op(l, OP_LT, -1);
+            break;
+        case ND_LTE:
+            emit_op(l, OP_LTE, -1);
+            break;
+        default:
+            error("cannot lower node kind %d to bytecode.", node->kind);
+        }
+    }
+    free(nodes->data);
+    free(nodes);
+    free(targets->keys);
+    free(targets->vals);
+    free(targets);
+}
+
+/* Lowers the statements `code`, which return the value of the last one run. */
+Bytecode* lower_bytecode(Vector* code) {
+    Lowering l = {.cells = create_vector()};
+    bool returned = false;
+    for (int i = 0; i < code->len && !returned; i++) {
+        Node* node = code->data[i];
+        if (i > 0) {
+            emit_op(&l, OP_POP, -1);
+        }
+        returned = node->kind == ND_RETURN;
+        lower_expr(&l, returned ? node->lhs : node);
+    }
+    if (code->len == 0) {
+        emit_op_val(&l, OP_PUSH, 1, 0);
+    }
+    emit_op(&l, OP_RET, -1);
+
+    Bytecode* bc = calloc(1, sizeof(Bytecode));
+    bc->len = l.cells->len;
+    bc->code = calloc(bc->len, sizeof(Cell));
+    for (int i = 0; i < bc->len; i++) {
+        bc->code[i].val = (long)l.cells->data[i];
+    }
+    bc->ops = l.ops;
+    bc->vars = l.vars;
+    bc->depth = l.max_depth;
+    free(l.cells->data);
+    free(l.cells);
+    return bc;
+}
+
+/* Divides like `idiv`, which raises #DE and so SIGFPE for these. */
+long divide(long lhs, long rhs) {
+    if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {
+        raise(SIGFPE);
+    }
+    return lhs / rhs;
+}
+
+/* Operations wrap around through unsigned arithmetic, where overflow is defined. */
+#define WRAP(a, op, b) ((long)((uint64_t)(a)op(uint64_t)(b)))
+
+long run_switch(Bytecode* bc, long* stack, long* vars) {
+    Cell* pc = bc->code;
+    long* sp = stack;
+    for (;;) {
+        switch ((pc++)->val) {
+        case OP_PUSH:
+            *sp++ = (pc++)->val;
+            break;
+        case OP_LOAD:
+            *sp++ = vars[(pc++)->val];
+            break;
+        case OP_STORE:
+            vars[(pc++)->val] = sp[-1];
+            break;
+        case OP_POP:
+            sp--;
+            break;
+        case OP_ADD:
+            sp--;
+            sp[-1] = WRAP(sp[-1], +, sp[0]);
+            break;
+        case OP_SUB:
+            sp--;
+            sp[-1] = WRAP(sp[-1], -, sp[0]);
+            break;
+        case OP_MUL:
+            sp--;
+            sp[-1] = WRAP(sp[-1], *, sp[0]);
+            break;
+        case OP_DIV:
+            sp--;
+            sp[-1] = divide(sp[-1], sp[0]);
+            break;
+        case OP_SHL:
+            /* `shl` masks the count to 6 bits. */
+            sp--;
+            sp[-1] = WRAP(sp[-1], <<, sp[0] & 63);
+            break;
+        case OP_EQ:
+            sp--;
+            sp[-1] = sp[-1] == sp[0];
+            break;
+        case OP_NEQ:
+            sp--;
+            sp[-1] = sp[-1] != sp[0];
+            break;
+        case OP_LT:
+            sp--;
+            sp[-1] = sp[-1] < sp[0];
+            break;
+        case OP_LTE:
+            sp--;
+            sp[-1] = sp[-1] <= sp[0];
+            break;
+        case OP_RET:
+            return sp[-1];
+        }
+    }
+}
+
+#ifdef __GNUC__
+/* Labels as values are a GNU extension, which other compilers run by the switch instead. */
+#define HAVE_COMPUTED_GOTO
+#endif
+
+#ifdef HAVE_COMPUTED_GOTO
+#define NEXT goto*(pc++)->handler
+
+long run_threaded(Bytecode* bc, long* stack, long* vars) {
+    static void* handlers[] = {
+        [OP_PUSH] = &&push, [OP_LOAD] = &&load, [OP_STORE] = &&store, [OP_POP] = &&pop,
+        [OP_ADD] = &&add,   [OP_SUB] = &&sub,   [OP_MUL] = &&mul,     [OP_DIV] = &&div,
+        [OP_SHL] = &&shl,   [OP_EQ] = &&eq,     [OP_NEQ] = &&neq,     [OP_LT] = &&lt,
+        [OP_LTE] = &&lte,   [OP_RET] = &&ret,
+    };
+    if (!bc->thread) {
+        /* Opcodes become handler addresses, and operands are kept. */
+        bc->thread = calloc(bc->len, sizeof(Cell));
+        for (int i = 0; i < bc->len; i++) {
+            Opcode op = bc->code[i].val;
+            bc->thread[i].handler = handlers[op];
+            if (op == OP_PUSH || op == OP_LOAD || op == OP_STORE) {
+                i++;
+                bc->thread[i] = bc->code[i];
+            }
+        }
+    }
+
+    Cell* pc = bc->thread;
+    long* sp = stack;
+    NEXT;
+push:
+    *sp++ = (pc++)->val;
+    NEXT;
+load:
+    *sp++ = vars[(pc++)->val];
+    NEXT;
+store:
+    vars[(pc++)->val] = sp[-1];
+    NEXT;
+pop:
+    sp--;
+    NEXT;
+add:
+    sp--;
+    sp[-1] = WRAP(sp[-1], +, sp[0]);
+    NEXT;
+sub:
+    sp--;
+    sp[-1] = WRAP(sp[-1], -, sp[0]);
+    NEXT;
+mul:
+    sp--;
+    sp[-1] = WRAP(sp[-1], *, sp[0]);
+    NEXT;
+div:
+    sp--;
+    sp[-1] = divide(sp[-1], sp[0]);
+    NEXT;
+shl:
+    sp--;
+    sp[-1] = WRAP(sp[-1], <<, sp[0] & 63);
+    NEXT;
+eq:
+    sp--;
+    sp[-1] = sp[-1] == sp[0];
+    NEXT;
+neq:
+    sp--;
+    sp[-1] = sp[-1] != sp[0];
+    NEXT;
+lt:
+    sp--;
+    sp[-1] = sp[-1] < sp[0];
+    NEXT;
+lte:
+    sp--;
+    sp[-1] = sp[-1] <= sp[0];
+    NEXT;
+ret:
+    return sp[-1];
+}
+#endif
+
+/* Runs `bc` and returns its result, by threaded dispatch where the compiler supports it. */
+long run_bytecode(Bytecode* bc, Dispatch dispatch) {
+    long* stack = calloc(bc->depth + 1, sizeof(long));
+    /* Variables read before they are stored are 0, where the generated code reads garbage. */
+    long* vars = calloc(bc->vars + 1, sizeof(long));
+    long result;
+#ifdef HAVE_COMPUTED_GOTO
+    if (dispatch == DISPATCH_THREADED) {
+        result = run_threaded(bc, stack, vars);
+    } else {
+        result = run_switch(bc, stack, vars);
+    }
+#else
+    result = run_switch(bc, stack, vars);
+#endif
+    free(stack);
+    free(vars);
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "vector.h"
+
+typedef enum {
+    OP_PUSH,  // Pushes the operand.
+    OP_LOAD,  // Pushes the variable numbered by the operand.
+    OP_STORE, // Stores the top of the stack to the variable numbered by the operand, keeping it.
+    OP_POP,
+    OP_ADD, // The binary operations pop the right operand and replace the left one.
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SHL,
+    OP_EQ,
+    OP_NEQ,
+    OP_LT,
+    OP_LTE,
+    OP_RET, // Returns the top of the stack.
+} Opcode;
+
+/* One word of the code, an opcode or an operand, or the address of its handler once threaded. */
+typedef union {
+    long val;
+    void* handler;
+} Cell;
+
+/* Stack machine code of a program. */
+typedef struct {
+    Cell* code;
+    int len;
+    int ops;      // Number of instructions, which all run as there are no branches.
+    int vars;     // Number of variables.
+    int depth;    // Deepest the stack gets.
+    Cell* thread; // `code` with handler addresses, made by the first threaded run.
+} Bytecode;
+
+/* How the interpreter goes from one instruction to the next. */
+typedef enum {
+    DISPATCH_SWITCH,   // A loop over a switch on the opcode.
+    DISPATCH_THREADED, // A jump to the handler address of each instruction, by computed goto.
+} Dispatch;
+
+Bytecode* lower_bytecode(Vector* code);
+
+long run_bytecode(Bytecode* bc, Dispatch dispatch);
+
+#endif // !INTERP_H
@@ -0,0 +1,193 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "ir.h"
+#include "map.h"
+#include "node.h"
+#include "vector.h"
+
+/*
+ * Three-address IR.
+ *
+ * Every statement is lowered to instructions that compute each node into a fresh virtual
+ * register, and load or store local variables explicitly. A final `ret` returns the value of the
+ * last statement, like the code generated from the tree does for programs without `return`.
+ * Statements after a `return` start a new block, which has no predecessors.
+ *
+ * ex. `a=2; return a*3+1;`
+ *
+ * b0:
+ *   v1 = 2
+ *   store a, v1
+ *   v2 = load a
+ *   v3 = 3
+ *   v4 = mul v2, v3
+ *   v5 = 1
+ *   v6 = add v4, v5
+ *   ret v6
+ */
+
+Block* new_block(IrProgram* prog) {
+    Block* block = calloc(1, sizeof(Block));
+    block->id = prog->blocks->len;
+    block->irs = create_vector();
+    block->preds = create_vector();
+    block->succs = create_vector();
+    vec_push(prog->blocks, block);
+    return block;
+}
+
+Ir* new_ir(Block* block, IrKind kind) {
+    Ir* ir = calloc(1, sizeof(Ir));
+    ir->kind = kind;
+    vec_push(block->irs, ir);
+    return ir;
+}
+
+int new_reg(IrProgram* prog) { return ++prog->reg_count; }
+
+/* Register holding the value of `node`, which has already been lowered. */
+int reg_of(Map* regs, Node* node) { return (int)(long)map_get(regs, node); }
+
+/* Lowers one statement in post order, and returns the register of its value. */
+int lower_statement(IrProgram* prog, Block* block, Node* root) {
+    Vector* nodes = postorder_nodes(root);
+    Map* regs = create_map();
+    /* Variables assigned to are stored, not loaded. */
+    Map* targets = assignment_targets(nodes);
+
+    int reg = 0;
+    for (int i = 0; i < nodes->len; i++) {
+        Node* node = nodes->data[i];
+        Ir* ir;
+        switch (node->kind) {
+        case ND_NUM:
+            ir = new_ir(block, IR_IMM);
+            ir->dst = reg = new_reg(prog);
+            ir->val = node->val;
+            break;
+        case ND_LVAR:
+            if (map_contains(targets, node)) {
+                continue;
+            }
+            ir = new_ir(block, IR_LOAD);
+            ir->dst = reg = new_reg(prog);
+            ir->lvar = node->lvar;
+            break;
+        case ND_ASSIGN:
+            ir = new_ir(block, IR_STORE);
+            ir->lhs = reg = reg_of(regs, node->rhs);
+            ir->lvar = node->lhs->lvar;
+            break;
+        case ND_RETURN:
+            ir = new_ir(block, IR_RET);
+            ir->lhs = reg = reg_of(regs, node->lhs);
+            break;
+        default:
+            ir = new_ir(block, IR_BIN);
+            ir->op = node->kind;
+            ir->lhs = reg_of(regs, node->lhs);
+            ir->rhs = reg_of(regs, node->rhs);
+            ir->dst = reg = new_reg(prog);
+            break;
+        }
+        map_put(regs, node, (void*)(long)reg);
+    }
+
+    free(nodes->data);
+    free(nodes);
+    return reg;
+}
+
+IrProgram* lower_program(Vector* code) {
+    IrProgram* prog = calloc(1, sizeof(IrProgram));
+    prog->blocks = create_vector();
+    Block* block = new_block(prog);
+    int reg = 0;
+    for (int i = 0; i < code->len; i++) {
+        Node* node = code->data[i];
+        /* Nothing runs into the statements after a `return`. */
+        if (!block) {
+            block = new_block(prog);
+        }
+        reg = lower_statement(prog, block, node);
+        if (node->kind == ND_RETURN) {
+            block = NULL;
+        }
+    }
+    if (!block) {
+        return prog;
+    }
+    if (!reg) {
+        Ir* ir = new_ir(block, IR_IMM);
+        ir->dst = reg = new_reg(prog);
+    }
+    new_ir(block, IR_RET)->lhs = reg;
+    return prog;
+}
+
+char* op_name(NodeKind op) {
+    switch (op) {
+    case ND_ADD:
+        return "add";
+    case ND_SUB:
+        return "sub";
+    case ND_MUL:
+        return "mul";
+    case ND_DIV:
+        return "div";
+    case ND_SHL:
+        return "shl";
+    case ND_EQ:
+        return "eq";
+    case ND_NEQ:
+        return "ne";
+    case ND_LT:
+        return "lt";
+    case ND_LTE:
+        return "le";
+    default:
+        error("not a binary operator.");
+        return NULL;
+    }
+}
+
+void print_ir_insn(Ir* ir, FILE* out) {
+    switch (ir->kind) {
+    case IR_IMM:
+        fprintf(out, "  v%d = %ld\n", ir->dst, ir->val);
+        return;
+    case IR_LOAD:
+        fprintf(out, "  v%d = load %.*s\n", ir->dst, ir->lvar->len, ir->lvar->name);
+        return;
+    case IR_STORE:
+        fprintf(out, "  store %.*s, v%d\n", ir->lvar->len, ir->lvar->name, ir->lhs);
+        return;
+    case IR_BIN:
+        fprintf(out, "  v%d = %s v%d, v%d\n", ir->dst, op_name(ir->op), ir->lhs, ir->rhs);
+        return;
+    case IR_PHI:
+        fprintf(out, "  v%d = phi", ir->dst);
+        for (int i = 0; i < ir->args->len; i++) {
+            fprintf(out, "%s v%d", i ? "," : "", (int)(long)ir->args->data[i]);
+        }
+        fprintf(out, "\n");
+        return;
+    case IR_RET:
+        fprintf(out, "  ret v%d\n", ir->lhs);
+        return;
+    }
+}
+
+/* Prints `prog` in the text form of the example above. */
+void print_ir(IrProgram* prog, FILE* out) {
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        fprintf(out, "b%d:\n", block->id);
+        for (int j = 0; j < block->irs->len; j++) {
+            print_ir_insn(block->irs->data[j], out);
+        }
+    }
+}
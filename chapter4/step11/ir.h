@@ -0,0 +1,58 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+
+#include "node.h"
+#include "vector.h"
+
+typedef enum {
+    IR_IMM,   // dst = val
+    IR_LOAD,  // dst = lvar
+    IR_STORE, // lvar = lhs
+    IR_BIN,   // dst = lhs op rhs
+    IR_PHI,   // dst = args[i] when coming from preds[i]
+    IR_RET,   // return lhs
+} IrKind;
+
+/* Three-address instruction on virtual registers, numbered from 1. 0 is no register. */
+typedef struct Ir Ir;
+struct Ir {
+    IrKind kind;
+    NodeKind op; // Operator of IR_BIN, one of the binary NodeKind.
+    int dst;
+    int lhs;
+    int rhs;
+    long val;     // Value of IR_IMM.
+    LVar* lvar;   // Variable of IR_LOAD and IR_STORE.
+    Vector* args; // Registers of IR_PHI, in the order of the block's preds.
+};
+
+/* Basic block, run from its first instruction to its last. */
+typedef struct Block Block;
+struct Block {
+    int id;
+    Vector* irs;
+    Vector* preds;
+    Vector* succs;
+};
+
+/* Blocks of the whole program, blocks[0] is the entry. */
+typedef struct {
+    Vector* blocks;
+    int reg_count;
+} IrProgram;
+
+Block* new_block(IrProgram* prog);
+
+Ir* new_ir(Block* block, IrKind kind);
+
+int new_reg(IrProgram* prog);
+
+IrProgram* lower_program(Vector* code);
+
+void print_ir_insn(Ir* ir, FILE* out);
+
+void print_ir(IrProgram* prog, FILE* out);
+
+#endif // !IR_H
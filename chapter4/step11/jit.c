@@ -0,0 +1,109 @@
+/* MAP_ANONYMOUS and sysconf() are not part of C18. */
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "encode.h"
+#include "error.h"
+#include "insn.h"
+#include "jit.h"
+#include "node.h"
+#include "peephole.h"
+#include "tokenizer.h"
+#include "vector.h"
+
+/*
+ * In-process execution.
+ *
+ * The machine code is copied to pages mapped writable, which are then made executable and no
+ * longer writable before `main` is called like a C function. No page is ever writable and
+ * executable at once.
+ *
+ * jit_run() is the whole of it as a library call, from the source text to the result of `main`.
+ */
+
+/* Maps `code` executable with its `main` at `main_offset`, or returns NULL if no memory can be. */
+JitCode* map_code(MachineCode* code, int main_offset) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (code->len + page - 1) / page * page;
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(mem, code->bytes, code->len);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return NULL;
+    }
+
+    JitCode* jit = calloc(1, sizeof(JitCode));
+    jit->mem = mem;
+    jit->size = size;
+    jit->main = (long (*)(void))((char*)mem + main_offset);
+    return jit;
+}
+
+/* Loads the instructions `insns`, which must define `main`, into executable memory. */
+JitCode* jit_load(Vector* insns) {
+    MachineCode* code = encode(insns);
+    if (code->relocs->len > 0) {
+        error("undefined symbol: %s", ((Reloc*)code->relocs->data[0])->symbol);
+    }
+    Label* main = find_label(code, "main");
+    if (!main) {
+        error("undefined symbol: main");
+    }
+    JitCode* jit = map_code(code, main->offset);
+    if (!jit) {
+        error("cannot map the code executable.");
+    }
+    return jit;
+}
+
+void jit_free(JitCode* jit) {
+    munmap(jit->mem, jit->size);
+    free(jit);
+}
+
+/*
+ * Compiles the program `source` at -O0, which skips the IR and register allocation, runs it in
+ * this process and stores what its main returns to `result`. Returns false without running it if
+ * the program has syntax errors, which are reported, or its code cannot be loaded. The variables,
+ * error count and peephole statistics of the compiler are left as they were.
+ */
+bool jit_run(char* source, long* result) {
+    LVar* saved_locals = locals;
+    int saved_count = error_count;
+    int saved_limit = error_limit;
+    /* Each program has its own variables, and reports all its errors without exiting. */
+    locals = NULL;
+    error_limit = 0;
+    Token* token = tokenize(source);
+    Vector* code = program(source, &token);
+    bool parsed = error_count == saved_count;
+    error_count = saved_count;
+    error_limit = saved_limit;
+
+    JitCode* jit = NULL;
+    if (parsed) {
+        generate_program(code, false);
+        MachineCode* machine = encode(rewrite_insns(take_insns(), false));
+        Label* main = find_label(machine, "main");
+        if (machine->relocs->len == 0 && main) {
+            jit = map_code(machine, main->offset);
+        }
+    }
+    locals = saved_locals;
+    if (!jit) {
+        return false;
+    }
+    *result = jit->main();
+    jit_free(jit);
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vector.h"
+
+/* Machine code mapped executable, and its `main` to call. */
+typedef struct {
+    void* mem;
+    size_t size;
+    long (*main)(void);
+} JitCode;
+
+JitCode* jit_load(Vector* insns);
+
+void jit_free(JitCode* jit);
+
+bool jit_run(char* source, long* result);
+
+#endif // !JIT_H
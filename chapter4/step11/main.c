@@ -1,49 +1,456 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "codegen.h"
+#include "coloring.h"
+#include "dce.h"
+#include "encode.h"
 #include "error.h"
+#include "eval.h"
+#include "fold.h"
+#include "gvn.h"
+#include "incremental.h"
+#include "insn.h"
+#include "interp.h"
+#include "jit.h"
+#include "ir.h"
 #include "node.h"
+#include "object.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "sccp.h"
+#include "serialize.h"
+#include "simplify.h"
+#include "ssa.h"
 #include "tokenizer.h"
+#include "x86.h"
+
+#define USAGE                                                                                      \
+    "usage: 9cc [-O<n>] [-feval | -feval-fuel=N] [-fno-const-prop] [-fstack-machine]\n"            \
+    "           [-fno-peephole] [--emit-ir] [--stats] [-ferror-limit=N] [--emit-ast=FILE]\n"       \
+    "           [-c | --exe | --run | --interp[=switch]] [-o FILE] <program | ->\n"                \
+    "       9cc [-O<n>] [-feval | -feval-fuel=N] [-fno-const-prop] [-fstack-machine]\n"            \
+    "           [-fno-peephole] [--emit-ir] [--stats] [-c | --exe | --run | --interp[=switch]]\n"  \
+    "           [-o FILE] --load-ast=FILE\n"                                                       \
+    "       9cc [-O<n>] --incremental\n"                                                           \
+    "       9cc [--stats] --peephole < ASSEMBLY\n"                                                 \
+    "       9cc [-c | --exe] [-o FILE] --encode < ASSEMBLY"
 
 char* user_input;
 
 Token* token;
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        error("argument should be 1");
+/*
+ * Optimization level given by `-O<n>`, 0 generates code straight from the parsed tree, 1 runs
+ * the IR passes with linear scan register allocation and 2 colors the registers instead.
+ */
+int opt_level = 1;
+
+/* Print the IR instead of assembly. */
+bool emit_ir = false;
+
+/* Print what the optimizations did to stderr. */
+bool print_stats = false;
+
+/* Node evaluations allowed to run the whole program at compile time, 0 to not try. */
+long eval_fuel = 0;
+
+/* Propagate constants through variables, off by `-fno-const-prop` to test the backend. */
+bool const_prop = true;
+
+/* Generate -O0 code with a push and a pop per operand, as `-fstack-machine` asks for comparison. */
+bool stack_machine = false;
+
+/* Rewrite the emitted instructions by the peephole rules, off by `-fno-peephole`. */
+bool peephole_opt = true;
+
+/* Write an ELF relocatable object instead of assembly, by `-c`. */
+bool write_obj = false;
+
+/* Write a static executable that needs neither libc nor a linker, by `--exe`. */
+bool write_exe = false;
+
+/* Run the code in this process and exit with its result, by `--run`. */
+bool run_jit = false;
+
+/* Run the program on the bytecode interpreter and exit with its result, by `--interp`. */
+bool interp = false;
+
+/* Dispatch of the interpreter, by a switch with `--interp=switch`. */
+Dispatch dispatch = DISPATCH_THREADED;
+
+/* Result of the program run by `--run` or `--interp`. */
+long run_result;
+
+/* Nanoseconds since some fixed time. */
+long now_ns() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Nanoseconds per call of `run` with `arg`, called in batches of doubling size until they take
+ * 10 ms, so that reading the clock costs little against short runs.
+ */
+double time_runs(long (*run)(void*), void* arg) {
+    long runs = 0;
+    long start = now_ns();
+    long elapsed = 0;
+    for (long batch = 1; elapsed < 10000000; batch *= 2) {
+        for (long i = 0; i < batch; i++) {
+            run(arg);
+        }
+        runs += batch;
+        elapsed = now_ns() - start;
     }
+    return (double)elapsed / runs;
+}
 
-    user_input = argv[1];
-    /* Create token linked list. */
-    token = tokenize(user_input);
-    /* Create nodes of a abstract syntax tree. */
-    Node* code[100];
-    program(user_input, &token, code);
+long call_main(void* jit) { return ((JitCode*)jit)->main(); }
 
-    printf(".intel_syntax noprefix\n");
-    printf(".global main\n");
-    printf("main:\n");
+long interpret(void* bc) { return run_bytecode(bc, dispatch); }
+
+/*
+ * Prints the emitted assembly, or writes its object with `-c` or its executable with `--exe`, or
+ * runs it with `--run`.
+ */
+void print_assembly() {
+    Vector* insns = take_insns();
+    if (peephole_opt) {
+        insns = peephole(insns);
+        if (print_stats) {
+            print_peephole_stats(stderr);
+        }
+    }
+    if (write_obj) {
+        write_object(encode(insns), stdout);
+        return;
+    }
+    if (write_exe) {
+        write_executable(insns, stdout);
+        return;
+    }
+    if (run_jit) {
+        JitCode* jit = jit_load(insns);
+        run_result = jit->main();
+        if (print_stats) {
+            fprintf(stderr, "run: %.1f ns per run\n", time_runs(call_main, jit));
+        }
+        jit_free(jit);
+        return;
+    }
+    for (int i = 0; i < insns->len; i++) {
+        print_insn(insns->data[i], stdout);
+    }
+}
+
+/* Optimizes the statements for `opt_level` and prints their assembly, or interprets them. */
+void compile(Vector* code) {
+    long val;
+    if (eval_fuel > 0 && evaluate_program(code, eval_fuel, &val)) {
+        if (print_stats) {
+            fprintf(stderr, "eval: returns %ld\n", val);
+        }
+        if (!emit_ir && !interp) {
+            generate_return_program(val);
+            print_assembly();
+            return;
+        }
+        code = create_vector();
+        vec_push(code, create_node(ND_RETURN, create_node_num(val), NULL));
+    } else if (eval_fuel > 0 && print_stats) {
+        fprintf(stderr, "eval: gave up\n");
+    }
 
-    /* Prologue. */
-    printf("  push rbp\n");
-    printf("  mov rbp, rsp\n");
-    printf("  sub rsp, 208\n");
+    if (opt_level >= 1) {
+        fold_constants(code);
+        simplify(code);
+    }
+    if (interp) {
+        Bytecode* bc = lower_bytecode(code);
+        run_result = run_bytecode(bc, dispatch);
+        if (print_stats) {
+            double ns = time_runs(interpret, bc);
+            fprintf(stderr, "interp: %d ops, %.1f ns per run, %.2f ns per op\n", bc->ops, ns,
+                    ns / bc->ops);
+        }
+        return;
+    }
+    if (opt_level == 0 && !emit_ir) {
+        generate_program(code, stack_machine);
+        print_assembly();
+        return;
+    }
 
-    /* Generate code from code[0]. */
-    for (int i = 0; code[i]; i++) {
-        generate_asm_code(code[i]);
+    IrProgram* prog = lower_program(code);
+    if (opt_level >= 1) {
+        build_ssa(prog);
+        number_values(prog);
+        if (const_prop) {
+            propagate_constants(prog);
+        }
+        int eliminated = eliminate_dead_code(prog);
+        if (print_stats) {
+            fprintf(stderr, "dce: eliminated %d instructions\n", eliminated);
+        }
+    }
+    if (emit_ir) {
+        print_ir(prog, stdout);
+        return;
+    }
+    /* Graph coloring takes longer, and spills and moves less. */
+    Allocation* alloc = opt_level >= 2 ? color_registers(prog) : linear_scan(prog);
+    generate_ir_program(prog, alloc);
+    print_assembly();
+    if (print_stats) {
+        fprintf(stderr, "regalloc: spilled %d of %d registers\n", alloc->spilled,
+                prog->reg_count);
+    }
+}
 
-        /* Always ends with `push rax`, so apply `pop` not to overflow stack. */
-        printf("  pop rax\n");
+/* Reads the whole stdin, so that inputs longer than the argument size limit can be compiled. */
+char* read_stdin() {
+    int capacity = 4096;
+    int len = 0;
+    char* buf = malloc(capacity);
+    for (;;) {
+        if (capacity - len == 1) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            if (!buf) {
+                error("out of memory.");
+            }
+        }
+        int n = fread(buf + len, 1, capacity - len - 1, stdin);
+        if (n == 0) {
+            break;
+        }
+        len += n;
     }
+    buf[len] = '\0';
+    return buf;
+}
 
-    /* Epilogue. */
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");
-    printf("  ret\n");
+/* Reads stdin up to the next NUL byte, or returns NULL at the end of input. */
+char* read_stdin_until_nul() {
+    int capacity = 4096;
+    int len = 0;
+    char* buf = malloc(capacity);
+    int c;
+    while ((c = getchar()) != EOF && c != '\0') {
+        if (len == capacity - 1) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            if (!buf) {
+                error("out of memory.");
+            }
+        }
+        buf[len++] = c;
+    }
+    if (c == EOF && len == 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
 
+/*
+ * Editor integration: reads successive versions of the source separated by NUL bytes, and
+ * writes the assembly of each version followed by a NUL byte. Only edited statements are parsed
+ * again, and at -O0 only their code and the code depending on the frame are generated again. A
+ * version with errors gets no assembly.
+ */
+int run_incremental() {
+    /* Errors are counted per version, so an editor session never hits the limit. */
+    error_limit = 0;
+    input_name = "<stdin>";
+    IncrementalParser* parser = create_incremental_parser();
+    for (char* source; (source = read_stdin_until_nul());) {
+        update_source(parser, source);
+        fprintf(stderr, "incremental: parsed %d of %d statements\n", parser->reparsed,
+                parser->spans->len);
+        if (parser->errors > 0) {
+            /* No assembly. */
+        } else if (opt_level == 0 && !emit_ir && !interp && eval_fuel == 0) {
+            generate_incremental(parser, stack_machine);
+            print_assembly();
+            fprintf(stderr, "incremental: generated %d of %d statements\n", parser->regenerated,
+                    parser->spans->len);
+        } else {
+            compile(incremental_code(parser));
+        }
+        putchar('\0');
+        fflush(stdout);
+        free(source);
+    }
     return EXIT_SUCCESS;
 }
+
+int main(int argc, char** argv) {
+    char* input = NULL;
+    char* emit_ast = NULL;
+    char* load_ast = NULL;
+    bool peephole_only = false;
+    bool encode_only = false;
+    char* output = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--incremental") == 0) {
+            return run_incremental();
+        }
+        if (strncmp(argv[i], "-ferror-limit=", 14) == 0) {
+            /* Stop after this many errors, 0 for no limit. */
+            error_limit = atoi(argv[i] + 14);
+            continue;
+        }
+        if (strncmp(argv[i], "-O", 2) == 0) {
+            opt_level = atoi(argv[i] + 2);
+            continue;
+        }
+        if (strcmp(argv[i], "-feval") == 0) {
+            eval_fuel = 1000000;
+            continue;
+        }
+        if (strncmp(argv[i], "-feval-fuel=", 12) == 0) {
+            eval_fuel = atol(argv[i] + 12);
+            continue;
+        }
+        if (strcmp(argv[i], "-fno-const-prop") == 0) {
+            const_prop = false;
+            continue;
+        }
+        if (strcmp(argv[i], "-fstack-machine") == 0) {
+            stack_machine = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-fno-peephole") == 0) {
+            peephole_opt = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--peephole") == 0) {
+            peephole_only = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--encode") == 0) {
+            encode_only = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-c") == 0) {
+            write_obj = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-o") == 0) {
+            /* Write the output to a file instead of stdout. */
+            if (++i == argc) {
+                error(USAGE);
+            }
+            output = argv[i];
+            if (!freopen(output, "wb", stdout)) {
+                error("cannot open %s.", output);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--exe") == 0) {
+            write_exe = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--run") == 0) {
+            run_jit = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--interp") == 0 || strcmp(argv[i], "--interp=switch") == 0) {
+            interp = true;
+            dispatch = argv[i][8] ? DISPATCH_SWITCH : DISPATCH_THREADED;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--emit-ir") == 0) {
+            emit_ir = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--emit-ast=", 11) == 0) {
+            /* Write the AST to a file instead of assembly. */
+            emit_ast = argv[i] + 11;
+            continue;
+        }
+        if (strncmp(argv[i], "--load-ast=", 11) == 0) {
+            /* Generate assembly from an AST file instead of a program. */
+            load_ast = argv[i] + 11;
+            continue;
+        }
+        if (input) {
+            error(USAGE);
+        }
+        input = argv[i];
+    }
+    if (write_obj + write_exe + run_jit + interp > 1) {
+        error(USAGE);
+    }
+    if (write_exe && output) {
+        chmod(output, 0755);
+    }
+    if (peephole_only || encode_only) {
+        if (input || load_ast || (peephole_only && encode_only)) {
+            error(USAGE);
+        }
+        /* Rewrite or encode assembly read from stdin, to test the rules and the encoder. */
+        char* source = read_stdin();
+        for (char* line = strtok(source, "\n"); line; line = strtok(NULL, "\n")) {
+            emit("%s", line);
+        }
+        if (encode_only && write_obj) {
+            write_object(encode(take_insns()), stdout);
+        } else if (encode_only && write_exe) {
+            write_executable(take_insns(), stdout);
+        } else if (encode_only) {
+            write_code(encode(take_insns()), stdout);
+        } else {
+            print_assembly();
+        }
+        return EXIT_SUCCESS;
+    }
+    if (load_ast) {
+        if (input) {
+            error(USAGE);
+        }
+        /* Skip tokenize() and program() and use the cached AST. */
+        compile(ast_to_nodes(map_ast(load_ast)));
+        return run_jit || interp ? run_result : EXIT_SUCCESS;
+    }
+    if (!input) {
+        error(USAGE);
+    }
+
+    /* `-` reads the program from stdin. */
+    if (strcmp(input, "-") == 0) {
+        input_name = "<stdin>";
+        user_input = read_stdin();
+    } else {
+        user_input = input;
+    }
+    /* Create token linked list. */
+    token = tokenize(user_input);
+    /* Create nodes of a abstract syntax tree. */
+    Vector* code = program(user_input, &token);
+    /* Every error has been reported in one pass, now give up before code generation. */
+    if (error_count > 0) {
+        return EXIT_FAILURE;
+    }
+    if (emit_ast) {
+        write_ast(emit_ast, code, locals);
+        return EXIT_SUCCESS;
+    }
+
+    compile(code);
+
+    /* The exit status is the low byte of the result, as for an executable. */
+    return run_jit || interp ? run_result : EXIT_SUCCESS;
+}
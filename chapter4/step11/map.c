@@ -0,0 +1,64 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "map.h"
+
+Map* create_map() {
+    Map* map = calloc(1, sizeof(Map));
+    map->capacity = 16;
+    map->keys = calloc(map->capacity, sizeof(void*));
+    map->vals = calloc(map->capacity, sizeof(void*));
+    return map;
+}
+
+/* Index of `key`, or of the empty slot where it would be inserted. */
+int map_find(Map* map, void* key) {
+    /* Fibonacci hashing spreads aligned pointers over the table. */
+    uint64_t hash = (uint64_t)(uintptr_t)key * 11400714819323198485ull;
+    int i = hash >> 32 & (map->capacity - 1);
+    while (map->keys[i] && map->keys[i] != key) {
+        i = (i + 1) & (map->capacity - 1);
+    }
+    return i;
+}
+
+void map_grow(Map* map) {
+    void** keys = map->keys;
+    void** vals = map->vals;
+    int capacity = map->capacity;
+
+    map->capacity *= 2;
+    map->keys = calloc(map->capacity, sizeof(void*));
+    map->vals = calloc(map->capacity, sizeof(void*));
+    if (!map->keys || !map->vals) {
+        error("out of memory.");
+    }
+    for (int i = 0; i < capacity; i++) {
+        if (keys[i]) {
+            int j = map_find(map, keys[i]);
+            map->keys[j] = keys[i];
+            map->vals[j] = vals[i];
+        }
+    }
+    free(keys);
+    free(vals);
+}
+
+void map_put(Map* map, void* key, void* val) {
+    /* Keep the load factor under 1/2. */
+    if (map->len * 2 >= map->capacity) {
+        map_grow(map);
+    }
+    int i = map_find(map, key);
+    if (!map->keys[i]) {
+        map->keys[i] = key;
+        map->len++;
+    }
+    map->vals[i] = val;
+}
+
+bool map_contains(Map* map, void* key) { return map->keys[map_find(map, key)] != NULL; }
+
+void* map_get(Map* map, void* key) { return map->vals[map_find(map, key)]; }
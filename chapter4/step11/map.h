@@ -0,0 +1,23 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdbool.h>
+
+/* Hash map keyed by pointer identity, with open addressing. */
+typedef struct Map Map;
+struct Map {
+    void** keys;
+    void** vals;
+    int capacity;
+    int len;
+};
+
+Map* create_map();
+
+void map_put(Map* map, void* key, void* val);
+
+bool map_contains(Map* map, void* key);
+
+void* map_get(Map* map, void* key);
+
+#endif // !MAP_H
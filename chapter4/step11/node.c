@@ -3,8 +3,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "error.h"
+#include "map.h"
 #include "node.h"
 #include "tokenizer.h"
+#include "vector.h"
 
 /* Recursive Decendent Parsing */
 /* Express by Backus-Naur form (BNF) */
@@ -45,7 +48,7 @@ Node* create_node(NodeKind kind, Node* lhs, Node* rhs) {
     return new_node;
 }
 
-Node* create_node_num(int val) {
+Node* create_node_num(long val) {
     Node* new_node = calloc(1, sizeof(Node));
     new_node->kind = ND_NUM;
     new_node->val = val;
@@ -94,18 +97,34 @@ char* create_lvar_name(Token* token, int letter_count) {
 }
 
 /* program = statement* */
-void program(char* user_input, Token** token, Node* code[]) {
-    int i = 0;
+/* Statements with syntax errors are reported and skipped, and parsing goes on after them. */
+Vector* program(char* user_input, Token** token) {
+    Vector* code = create_vector();
     while (!at_eof(*token)) {
-        code[i] = statement(user_input, token);
-        i++;
+        Node* node = statement(user_input, token);
+        if (node) {
+            vec_push(code, node);
+        } else {
+            synchronize(token);
+        }
     }
-    code[i] = NULL;
     /* After creating all nodes, assign all lvar offsets. */
     assign_lvar_offsets(locals);
+    return code;
+}
+
+/* Panic mode recovery: skips tokens to just after the next `;`, where a new statement starts. */
+void synchronize(Token** token) {
+    while (!at_eof(*token)) {
+        if (consume_op(token, ";")) {
+            return;
+        }
+        (*token) = (*token)->next;
+    }
 }
 
 /* statement = express ";" | "return" express ";" */
+/* Returns NULL after reporting a syntax error. */
 Node* statement(char* user_input, Token** token) {
     Node* node;
     if ((*token)->kind == TK_RETURN) {
@@ -113,111 +132,169 @@ Node* statement(char* user_input, Token** token) {
         node->kind = ND_RETURN;
         (*token) = (*token)->next;
         node->lhs = express(user_input, token);
+        if (!node->lhs) {
+            return NULL;
+        }
 
     } else {
         node = express(user_input, token);
+        if (!node) {
+            return NULL;
+        }
     }
-    expect_op(user_input, token, ";");
-    return node;
-}
-
-/* express = assign */
-Node* express(char* user_input, Token** token) { return assign(user_input, token); }
-
-/* assign = equality ("=" assign)? */
-Node* assign(char* user_input, Token** token) {
-    Node* node = equality(user_input, token);
-
-    if (consume_op(token, "=")) {
-        node = create_node(ND_ASSIGN, node, assign(user_input, token));
+    if (!expect_op(user_input, token, ";")) {
+        return NULL;
     }
-
     return node;
 }
 
-/* equality = relational ("==" relational | "!=" relational)* */
-Node* equality(char* user_input, Token** token) {
-    Node* node = relational(user_input, token);
-
-    for (;;) {
-        if (consume_op(token, "==")) {
-            node = create_node(ND_EQ, node, relational(user_input, token));
-        } else if (consume_op(token, "!=")) {
-            node = create_node(ND_NEQ, node, relational(user_input, token));
-        } else {
-            return node;
+/* Operator entry of the parser's operator stack. */
+typedef struct {
+    char* op;
+    NodeKind kind;
+    int precedence;
+    bool swap; // `>` and `>=` are built as `<` and `<=` with swapped operands.
+} Operator;
+
+/* Binary operators from lowest to highest precedence. `=` is the only right associative one. */
+static Operator binary_ops[] = {
+    {"=", ND_ASSIGN, 1, false}, {"==", ND_EQ, 2, false}, {"!=", ND_NEQ, 2, false},
+    {"<=", ND_LTE, 3, false},   {"<", ND_LT, 3, false},  {">=", ND_LTE, 3, true},
+    {">", ND_LT, 3, true},      {"+", ND_ADD, 4, false}, {"-", ND_SUB, 4, false},
+    {"*", ND_MUL, 5, false},    {"/", ND_DIV, 5, false},
+};
+
+/* Markers pushed on the operator stack for `(` and unary `-`. */
+static Operator paren_op = {"(", ND_NUM, 0, false};
+static Operator unary_minus_op = {"-", ND_SUB, 6, false};
+
+Operator* consume_binary_op(Token** token) {
+    for (int i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (consume_op(token, binary_ops[i].op)) {
+            return &binary_ops[i];
         }
     }
+    return NULL;
 }
 
-/* relational = add ("<" add | "<=" add | ">" add | ">=" add)* */
-Node* relational(char* user_input, Token** token) {
-    Node* node = add(user_input, token);
+/* Pops an operator and its operands, then pushes the new node to `operands`. */
+void reduce(Vector* operands, Vector* operators) {
+    Operator* op = vec_pop(operators);
+    if (op == &unary_minus_op) {
+        /* return a node that has 0-primary() */
+        vec_push(operands, create_node(ND_SUB, create_node_num(0), vec_pop(operands)));
+        return;
+    }
+    Node* rhs = vec_pop(operands);
+    Node* lhs = vec_pop(operands);
+    if (op->swap) {
+        vec_push(operands, create_node(op->kind, rhs, lhs));
+    } else {
+        vec_push(operands, create_node(op->kind, lhs, rhs));
+    }
+}
 
-    for (;;) {
-        if (consume_op(token, "<")) {
-            node = create_node(ND_LT, node, add(user_input, token));
-        } else if (consume_op(token, "<=")) {
-            node = create_node(ND_LTE, node, add(user_input, token));
-        } else if (consume_op(token, ">")) {
-            node = create_node(ND_LT, add(user_input, token), node);
-        } else if (consume_op(token, ">=")) {
-            node = create_node(ND_LTE, add(user_input, token), node);
-        } else {
-            return node;
-        }
+/* Reduces unary operators waiting for the primary that has just been pushed. */
+void reduce_unary(Vector* operands, Vector* operators) {
+    while (vec_last(operators) == &unary_minus_op) {
+        reduce(operands, operators);
     }
 }
 
-/* add = mul ("+" mul | "-" mul)* */
-Node* add(char* user_input, Token** token) {
-    Node* node = mul(user_input, token);
+/*
+ * express = assign
+ *
+ * Returns NULL after reporting a syntax error.
+ *
+ * The rules from `assign` down to `unary` are parsed by operator precedence with explicit
+ * operand and operator stacks instead of one C function per rule, so nesting depth is limited
+ * only by memory.
+ */
+Node* express(char* user_input, Token** token) {
+    Vector* operands = create_vector();
+    Vector* operators = create_vector();
+    /* Number of `(` waiting for their `)`. */
+    int depth = 0;
+    /* A new error means the expression is broken and NULL is returned. */
+    int errors = error_count;
 
     for (;;) {
-        if (consume_op(token, "+")) {
-            node = create_node(ND_ADD, node, mul(user_input, token));
-        } else if (consume_op(token, "-")) {
-            node = create_node(ND_SUB, node, mul(user_input, token));
+        /* Operand position: unary ("(" | primary). */
+        if (consume_op(token, "(")) {
+            vec_push(operators, &paren_op);
+            depth++;
+            continue;
+        }
+        if (consume_op(token, "-")) {
+            vec_push(operators, &unary_minus_op);
         } else {
-            return node;
+            consume_op(token, "+");
+        }
+        if (consume_op(token, "(")) {
+            vec_push(operators, &paren_op);
+            depth++;
+            continue;
+        }
+        Node* node = primary(user_input, token);
+        if (!node) {
+            break;
+        }
+        vec_push(operands, node);
+        reduce_unary(operands, operators);
+
+        /* Operator position: binary operator, ")" or the end of the expression. */
+        while (depth > 0 && consume_op(token, ")")) {
+            while (vec_last(operators) != &paren_op) {
+                reduce(operands, operators);
+            }
+            vec_pop(operators);
+            depth--;
+            reduce_unary(operands, operators);
         }
-    }
-}
 
-/* mul = unary ("*" unary | "/" unary)* */
-Node* mul(char* user_input, Token** token) {
-    Node* node = unary(user_input, token);
+        Token* op_token = *token;
+        Operator* op = consume_binary_op(token);
+        if (!op) {
+            break;
+        }
+        for (;;) {
+            Operator* last = vec_last(operators);
+            if (!last || last == &paren_op || last->precedence < op->precedence ||
+                (last->precedence == op->precedence && op->kind == ND_ASSIGN)) {
+                break;
+            }
+            reduce(operands, operators);
+        }
+        /* `=` has the lowest precedence, so its left operand is complete now. */
+        if (op->kind == ND_ASSIGN && ((Node*)vec_last(operands))->kind != ND_LVAR) {
+            error_at(user_input, op_token->str, "left value is not a variable");
+            break;
+        }
+        vec_push(operators, op);
+    }
 
-    for (;;) {
-        if (consume_op(token, "*")) {
-            node = create_node(ND_MUL, node, unary(user_input, token));
-        } else if (consume_op(token, "/")) {
-            node = create_node(ND_DIV, node, unary(user_input, token));
+    Node* node = NULL;
+    if (error_count == errors) {
+        if (depth > 0) {
+            error_at(user_input, (*token)->str, "expected ')'");
         } else {
-            return node;
+            while (operators->len > 0) {
+                reduce(operands, operators);
+            }
+            node = vec_pop(operands);
         }
     }
-}
 
-/* unary = ("+" | "-")? primary */
-Node* unary(char* user_input, Token** token) {
-    if (consume_op(token, "+")) {
-        return primary(user_input, token);
-    }
-    /* return a node that has 0-primary() */
-    if (consume_op(token, "-")) {
-        return create_node(ND_SUB, create_node_num(0), primary(user_input, token));
-    }
-    return primary(user_input, token);
+    free(operands->data);
+    free(operands);
+    free(operators->data);
+    free(operators);
+    return node;
 }
 
-/* primary = num | ident | "(" express ")" */
+/* primary = num | ident */
+/* Returns NULL after reporting a syntax error. */
 Node* primary(char* user_input, Token** token) {
-    if (consume_op(token, "(")) {
-        Node* node = express(user_input, token);
-        expect_op(user_input, token, ")");
-        return node;
-    }
     if ('a' <= (*token)->str[0] && (*token)->str[0] <= 'z') {
         /* Create new token to merge TK_IDENT tokens. */
         /* And move token list to the token after the merged token. */
@@ -246,7 +323,11 @@ Node* primary(char* user_input, Token** token) {
         return node;
     }
 
-    return create_node_num(expect_number(user_input, token));
+    long val;
+    if (!expect_number(user_input, token, &val)) {
+        return NULL;
+    }
+    return create_node_num(val);
 }
 
 LVar* find_lvar(Token* token, LVar* locals) {
@@ -266,3 +347,66 @@ void assign_lvar_offsets(LVar* locals) {
         var->offset = offset;
     }
 }
+
+/* Pushes the variable of every ND_LVAR node under `node` to `lvars`. */
+void collect_lvars(Node* node, Vector* lvars) {
+    Vector* stack = create_vector();
+    vec_push(stack, node);
+    while (stack->len > 0) {
+        Node* current = vec_pop(stack);
+        if (current->kind == ND_LVAR) {
+            vec_push(lvars, current->lvar);
+        }
+        if (current->lhs) {
+            vec_push(stack, current->lhs);
+        }
+        if (current->rhs) {
+            vec_push(stack, current->rhs);
+        }
+    }
+    free(stack->data);
+    free(stack);
+}
+
+/* Returns the nodes under `root` with children before their parent, lhs before rhs. */
+Vector* postorder_nodes(Node* root) {
+    Vector* nodes = create_vector();
+    Vector* stack = create_vector();
+    Node* last = NULL;
+    vec_push(stack, root);
+    while (stack->len > 0) {
+        Node* node = vec_last(stack);
+        /* `last` tells which child, if any, has just been finished. */
+        bool rhs_done = node->rhs && last == node->rhs;
+        bool lhs_done = rhs_done || (node->lhs && last == node->lhs);
+        if (node->lhs && !lhs_done) {
+            vec_push(stack, node->lhs);
+            continue;
+        }
+        if (node->rhs && !rhs_done) {
+            vec_push(stack, node->rhs);
+            continue;
+        }
+        vec_push(nodes, vec_pop(stack));
+        last = node;
+    }
+    free(stack->data);
+    free(stack);
+    return nodes;
+}
+
+/* Returns the ND_LVAR nodes among `nodes` that are the target of an ND_ASSIGN, mapped to it. */
+Map* assignment_targets(Vector* nodes) {
+    Map* targets = create_map();
+    for (int i = 0; i < nodes->len; i++) {
+        Node* node = nodes->data[i];
+        if (node->kind == ND_ASSIGN) {
+            map_put(targets, node->lhs, node);
+        }
+    }
+    return targets;
+}
+
+bool is_commutative(NodeKind kind) {
+    return kind == ND_ADD || kind == ND_MUL || kind == ND_EQ || kind == ND_NEQ;
+}
@@ -1,13 +1,16 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include "map.h"
 #include "tokenizer.h"
+#include "vector.h"
 
 typedef enum {
     ND_ADD,
     ND_SUB,
     ND_MUL,
     ND_DIV,
+    ND_SHL, // `lhs << rhs`, only made by simplify() from multiplications.
     ND_EQ,  // `==`
     ND_NEQ, // `!=`
     ND_LT,  // `<`
@@ -24,6 +27,7 @@ struct LVar {
     char* name;
     int len;    // Name length.
     int offset; // Stack location.
+    int refs;   // Number of ND_LVAR nodes using it, only kept by incremental parsing.
 };
 
 typedef struct Node Node;
@@ -31,13 +35,15 @@ struct Node {
     NodeKind kind;
     Node* lhs;
     Node* rhs;
-    int val;    // Only used when NodeKind is ND_NUM.
+    long val;   // Only used when NodeKind is ND_NUM.
     LVar* lvar; // Only used when NodeKind is ND_LVAR.
 };
 
+extern LVar* locals;
+
 Node* create_node(NodeKind kind, Node* lhs, Node* rhs);
 
-Node* create_node_num(int val);
+Node* create_node_num(long val);
 
 Node* create_node_lvar();
 
@@ -47,28 +53,26 @@ int count_token_letter(Token* token);
 
 char* create_lvar_name(Token* token, int letter_count);
 
-void program(char* user_input, Token** token, Node* code[]);
+Vector* program(char* user_input, Token** token);
+
+void synchronize(Token** token);
 
 Node* statement(char* user_input, Token** token);
 
 Node* express(char* user_input, Token** token);
 
-Node* assign(char* user_input, Token** token);
-
-Node* equality(char* user_input, Token** token);
-
-Node* relational(char* user_input, Token** token);
+Node* primary(char* user_input, Token** token);
 
-Node* add(char* user_input, Token** token);
+LVar* find_lvar(Token* token, LVar* locals);
 
-Node* mul(char* user_input, Token** token);
+void assign_lvar_offsets(LVar* locals);
 
-Node* unary(char* user_input, Token** token);
+void collect_lvars(Node* node, Vector* lvars);
 
-Node* primary(char* user_input, Token** token);
+Vector* postorder_nodes(Node* root);
 
-LVar* find_lvar(Token* token, LVar* locals);
+Map* assignment_targets(Vector* nodes);
 
-void assign_lvar_offsets(LVar* locals);
+bool is_commutative(NodeKind kind);
 
 #endif // !NODE_H
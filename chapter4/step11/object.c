@@ -0,0 +1,273 @@
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "error.h"
+#include "insn.h"
+#include "object.h"
+#include "vector.h"
+
+/*
+ * ELF64 relocatable object, laid out as
+ *
+ *   Elf64_Ehdr
+ *   .text              the machine code
+ *   .symtab            null, the section of .text, local labels, then global and undefined ones
+ *   .strtab            symbol names
+ *   .rela.text         relocations of the code, if any
+ *   .shstrtab          section names
+ *   Elf64_Shdr[]       section headers, in the order of ObjectSection
+ *
+ * `.L` labels are left out of the symbols like GNU as does, and an empty .note.GNU-stack tells
+ * the linker that the stack need not be executable.
+ */
+
+/* Index of each section header. */
+typedef enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_NOTE,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_RELA,
+    SEC_COUNT,
+} ObjectSection;
+
+/* Appends zeros to `buf` up to a multiple of `align`. */
+void buf_align(Buffer* buf, uint64_t align) {
+    while (buf->len % align) {
+        buf_append(buf, "", 1);
+    }
+}
+
+/* Appends `name` and its NUL to the string table `strtab`, and returns its offset. */
+uint32_t add_string(Buffer* strtab, char* name) {
+    uint32_t offset = strtab->len;
+    buf_append(strtab, name, strlen(name) + 1);
+    return offset;
+}
+
+void add_symbol(Buffer* symtab, Buffer* strtab, char* name, int bind, int type, int section,
+                uint64_t value) {
+    Elf64_Sym sym = {0};
+    sym.st_name = name ? add_string(strtab, name) : 0;
+    sym.st_info = ELF64_ST_INFO(bind, type);
+    sym.st_shndx = section;
+    sym.st_value = value;
+    buf_append(symtab, &sym, sizeof(sym));
+}
+
+/* Adds the symbols of `code`, and returns the index of the symbol of each relocation. */
+int* add_symbols(MachineCode* code, Buffer* symtab, Buffer* strtab, int* first_global) {
+    buf_append(strtab, "", 1);
+    add_symbol(symtab, strtab, NULL, STB_LOCAL, STT_NOTYPE, SHN_UNDEF, 0);
+    add_symbol(symtab, strtab, NULL, STB_LOCAL, STT_SECTION, SEC_TEXT, 0);
+    for (int i = 0; i < code->labels->len; i++) {
+        Label* label = code->labels->data[i];
+        if (!label->global && strncmp(label->name, ".L", 2) != 0) {
+            add_symbol(symtab, strtab, label->name, STB_LOCAL, STT_NOTYPE, SEC_TEXT,
+                       label->offset);
+        }
+    }
+
+    /* Locals come first, which the symtab header gives the end of. */
+    *first_global = symtab->len / sizeof(Elf64_Sym);
+    for (int i = 0; i < code->labels->len; i++) {
+        Label* label = code->labels->data[i];
+        if (label->global) {
+            add_symbol(symtab, strtab, label->name, STB_GLOBAL, STT_NOTYPE, SEC_TEXT,
+                       label->offset);
+        }
+    }
+    int* indices = calloc(code->relocs->len + 1, sizeof(int));
+    for (int i = 0; i < code->relocs->len; i++) {
+        Reloc* reloc = code->relocs->data[i];
+        /* Each undefined symbol is added once. */
+        for (int j = 0; j < i && !indices[i]; j++) {
+            if (strcmp(((Reloc*)code->relocs->data[j])->symbol, reloc->symbol) == 0) {
+                indices[i] = indices[j];
+            }
+        }
+        if (!indices[i]) {
+            indices[i] = symtab->len / sizeof(Elf64_Sym);
+            add_symbol(symtab, strtab, reloc->symbol, STB_GLOBAL, STT_NOTYPE, SHN_UNDEF, 0);
+        }
+    }
+    return indices;
+}
+
+/* Writes `code` as an ELF64 relocatable object for x86-64 to `out`. */
+void write_object(MachineCode* code, FILE* out) {
+    Buffer file = {0};
+    Elf64_Shdr sections[SEC_COUNT] = {0};
+    Buffer shstrtab = {0};
+    buf_append(&shstrtab, "", 1);
+    buf_append(&file, &(Elf64_Ehdr){0}, sizeof(Elf64_Ehdr));
+
+    /* GNU as aligns .text to 16 bytes. */
+    buf_align(&file, 16);
+    sections[SEC_TEXT] = (Elf64_Shdr){.sh_name = add_string(&shstrtab, ".text"),
+                                      .sh_type = SHT_PROGBITS,
+                                      .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+                                      .sh_offset = file.len,
+                                      .sh_size = code->len,
+                                      .sh_addralign = 16};
+    buf_append(&file, code->bytes, code->len);
+
+    sections[SEC_NOTE] = (Elf64_Shdr){.sh_name = add_string(&shstrtab, ".note.GNU-stack"),
+                                      .sh_type = SHT_PROGBITS,
+                                      .sh_offset = file.len,
+                                      .sh_addralign = 1};
+
+    Buffer symtab = {0};
+    Buffer strtab = {0};
+    int first_global;
+    int* indices = add_symbols(code, &symtab, &strtab, &first_global);
+    buf_align(&file, 8);
+    sections[SEC_SYMTAB] = (Elf64_Shdr){.sh_name = add_string(&shstrtab, ".symtab"),
+                                        .sh_type = SHT_SYMTAB,
+                                        .sh_offset = file.len,
+                                        .sh_size = symtab.len,
+                                        .sh_link = SEC_STRTAB,
+                                        .sh_info = first_global,
+                                        .sh_addralign = 8,
+                                        .sh_entsize = sizeof(Elf64_Sym)};
+    buf_append(&file, symtab.data, symtab.len);
+    sections[SEC_STRTAB] = (Elf64_Shdr){.sh_name = add_string(&shstrtab, ".strtab"),
+                                        .sh_type = SHT_STRTAB,
+                                        .sh_offset = file.len,
+                                        .sh_size = strtab.len,
+                                        .sh_addralign = 1};
+    buf_append(&file, strtab.data, strtab.len);
+
+    /* Displacements of calls and jumps are relative to the end of the instruction. */
+    int count = SEC_COUNT;
+    if (code->relocs->len > 0) {
+        buf_align(&file, 8);
+        sections[SEC_RELA] = (Elf64_Shdr){.sh_name = add_string(&shstrtab, ".rela.text"),
+                                          .sh_type = SHT_RELA,
+                                          .sh_flags = SHF_INFO_LINK,
+                                          .sh_offset = file.len,
+                                          .sh_size = code->relocs->len * sizeof(Elf64_Rela),
+                                          .sh_link = SEC_SYMTAB,
+                                          .sh_info = SEC_TEXT,
+                                          .sh_addralign = 8,
+                                          .sh_entsize = sizeof(Elf64_Rela)};
+        for (int i = 0; i < code->relocs->len; i++) {
+            Reloc* reloc = code->relocs->data[i];
+            Elf64_Rela rela = {reloc->offset, ELF64_R_INFO(indices[i], R_X86_64_PLT32),
+                               reloc->addend};
+            buf_append(&file, &rela, sizeof(rela));
+        }
+    } else {
+        count--;
+    }
+
+    sections[SEC_SHSTRTAB] = (Elf64_Shdr){.sh_name = add_string(&shstrtab, ".shstrtab"),
+                                          .sh_type = SHT_STRTAB,
+                                          .sh_offset = file.len,
+                                          .sh_addralign = 1};
+    sections[SEC_SHSTRTAB].sh_size = shstrtab.len;
+    buf_append(&file, shstrtab.data, shstrtab.len);
+
+    buf_align(&file, 8);
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file.data;
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header->e_type = ET_REL;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_shoff = file.len;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_shentsize = sizeof(Elf64_Shdr);
+    header->e_shnum = count;
+    header->e_shstrndx = SEC_SHSTRTAB;
+    buf_append(&file, sections, count * sizeof(Elf64_Shdr));
+
+    if (fwrite(file.data, 1, file.len, out) != file.len) {
+        error("cannot write the object file.");
+    }
+    free(indices);
+    free(file.data);
+    free(symtab.data);
+    free(strtab.data);
+    free(shstrtab.data);
+}
+
+/*
+ * Static executable, laid out as
+ *
+ *   Elf64_Ehdr
+ *   Elf64_Phdr[2]      the whole file loaded at EXE_BASE, readable and executable, and a
+ *                      PT_GNU_STACK asking for a stack that is not executable
+ *   .text              `_start` and the machine code
+ *
+ * with no section headers, since neither a linker nor libc reads the file.
+ */
+
+/* Address the file is loaded at, where the linker puts static executables. */
+#define EXE_BASE 0x400000
+
+/* Writes the instructions `insns`, which must define `main`, as a static executable to `out`. */
+void write_executable(Vector* insns, FILE* out) {
+    /* `_start` calls main with the stack aligned as at a call, and exits with its result. */
+    Insn* start = calloc(1, sizeof(Insn));
+    start->text = "_start:";
+    Vector* all = create_vector();
+    vec_push(all, start);
+    vec_push(all, new_insn("call", "main", NULL));
+    vec_push(all, new_insn("mov", "rdi", "rax"));
+    vec_push(all, new_insn("mov", "rax", "60"));
+    vec_push(all, new_insn("syscall", NULL, NULL));
+    for (int i = 0; i < insns->len; i++) {
+        vec_push(all, insns->data[i]);
+    }
+    MachineCode* code = encode(all);
+    if (code->relocs->len > 0) {
+        error("undefined symbol: %s", ((Reloc*)code->relocs->data[0])->symbol);
+    }
+
+    Buffer file = {0};
+    buf_append(&file, &(Elf64_Ehdr){0}, sizeof(Elf64_Ehdr));
+    buf_append(&file, (Elf64_Phdr[2]){0}, 2 * sizeof(Elf64_Phdr));
+    uint64_t text = file.len;
+    buf_append(&file, code->bytes, code->len);
+
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file.data;
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header->e_type = ET_EXEC;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_entry = EXE_BASE + text + find_label(code, "_start")->offset;
+    header->e_phoff = sizeof(Elf64_Ehdr);
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_phentsize = sizeof(Elf64_Phdr);
+    header->e_phnum = 2;
+
+    Elf64_Phdr* segments = (Elf64_Phdr*)(file.data + sizeof(Elf64_Ehdr));
+    segments[0] = (Elf64_Phdr){.p_type = PT_LOAD,
+                               .p_flags = PF_R | PF_X,
+                               .p_vaddr = EXE_BASE,
+                               .p_paddr = EXE_BASE,
+                               .p_filesz = file.len,
+                               .p_memsz = file.len,
+                               .p_align = 0x1000};
+    segments[1] = (Elf64_Phdr){.p_type = PT_GNU_STACK, .p_flags = PF_R | PF_W, .p_align = 16};
+
+    if (fwrite(file.data, 1, file.len, out) != file.len) {
+        error("cannot write the executable.");
+    }
+    free(file.data);
+}
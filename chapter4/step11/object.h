@@ -0,0 +1,13 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+
+#include "encode.h"
+#include "vector.h"
+
+void write_object(MachineCode* code, FILE* out);
+
+void write_executable(Vector* insns, FILE* out);
+
+#endif // !OBJECT_H
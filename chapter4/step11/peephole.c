@@ -0,0 +1,252 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "insn.h"
+#include "peephole.h"
+#include "vector.h"
+
+/*
+ * Peephole optimization.
+ *
+ * Instructions are moved one by one to the output, and after each one the rules are tried on the
+ * last instructions of the output until none matches. A rewrite only changes that window, so the
+ * instructions before it get another chance against the new ones, and the pass is linear.
+ *
+ * Rules match the text of the operands. A register is used by an instruction when an operand
+ * names it or its low byte, or when the instruction uses it implicitly. Labels and directives end
+ * every window, since jumps may land on them.
+ */
+
+/* 64 bit registers and their low bytes. */
+char* reg_names[][2] = {
+    {"rax", "al"}, {"rbx", "bl"}, {"rcx", "cl"}, {"rdx", "dl"}, {"rsi", "sil"}, {"rdi", "dil"},
+    {"rbp", "bpl"}, {"rsp", "spl"}, {"r8", "r8b"}, {"r9", "r9b"}, {"r10", "r10b"},
+    {"r11", "r11b"}, {"r12", "r12b"}, {"r13", "r13b"}, {"r14", "r14b"}, {"r15", "r15b"},
+};
+
+#define REG_NAME_COUNT (int)(sizeof(reg_names) / sizeof(reg_names[0]))
+
+bool is_reg(char* operand) {
+    for (int i = 0; i < REG_NAME_COUNT; i++) {
+        if (strcmp(operand, reg_names[i][0]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_imm(char* operand) { return isdigit(operand[0]) || operand[0] == '-'; }
+
+bool is_op(Insn* insn, char* op) { return insn->op && strcmp(insn->op, op) == 0; }
+
+/* Returns true if `name` appears in `operand` as a whole word. */
+bool names(char* operand, char* name) {
+    int len = strlen(name);
+    for (char* p = strstr(operand, name); p; p = strstr(p + 1, name)) {
+        bool start = p == operand || !isalnum(p[-1]);
+        bool end = !isalnum(p[len]);
+        if (start && end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns true if `insn` reads or writes the 64 bit register `reg`, or any part of it. */
+bool uses_reg(Insn* insn, char* reg) {
+    if (!insn->op) {
+        return true;
+    }
+    char* low = reg;
+    for (int i = 0; i < REG_NAME_COUNT; i++) {
+        if (strcmp(reg, reg_names[i][0]) == 0) {
+            low = reg_names[i][1];
+        }
+    }
+    for (int i = 0; i < insn->argc; i++) {
+        if (names(insn->args[i], reg) || names(insn->args[i], low)) {
+            return true;
+        }
+    }
+
+    /* Implicit operands. */
+    char* op = insn->op;
+    if (strcmp(reg, "rsp") == 0) {
+        return !strcmp(op, "push") || !strcmp(op, "pop") || !strcmp(op, "call") ||
+               !strcmp(op, "ret");
+    }
+    if (strcmp(reg, "rax") == 0 || strcmp(reg, "rdx") == 0) {
+        /* `imul` with one operand is rdx:rax = rax * operand. */
+        return !strcmp(op, "cqo") || !strcmp(op, "idiv") ||
+               (!strcmp(op, "imul") && insn->argc == 1);
+    }
+    return false;
+}
+
+/* Replaces the window of the last `width` instructions of `out` by `insn`, if not NULL. */
+void replace_window(Vector* out, int width, Insn* insn) {
+    out->len -= width;
+    if (insn) {
+        vec_push(out, insn);
+    }
+}
+
+/* `mov` from `src` to `dst`, or NULL if they are the same. */
+Insn* move(char* dst, char* src) { return strcmp(dst, src) ? new_insn("mov", dst, src) : NULL; }
+
+/* push X; pop Y => mov Y, X */
+bool push_pop(Vector* out, Insn** w) {
+    if (!is_op(w[0], "push") || !is_op(w[1], "pop") || !is_reg(w[1]->args[0])) {
+        return false;
+    }
+    replace_window(out, 2, move(w[1]->args[0], w[0]->args[0]));
+    return true;
+}
+
+/* push X; I; pop Y => I; mov Y, X, where I does not use X, Y or the stack. */
+bool push_op_pop(Vector* out, Insn** w) {
+    if (!is_op(w[0], "push") || !is_op(w[2], "pop") || !w[1]->op) {
+        return false;
+    }
+    char* x = w[0]->args[0];
+    char* y = w[2]->args[0];
+    if (!is_reg(y) || (!is_reg(x) && !is_imm(x))) {
+        return false;
+    }
+    if (uses_reg(w[1], "rsp") || uses_reg(w[1], y) || (is_reg(x) && uses_reg(w[1], x))) {
+        return false;
+    }
+    Insn* insn = w[1];
+    Insn* mov = move(y, x);
+    replace_window(out, 3, insn);
+    if (mov) {
+        vec_push(out, mov);
+    }
+    return true;
+}
+
+/* mov X, X => nothing */
+bool mov_self(Vector* out, Insn** w) {
+    if (!is_op(w[0], "mov") || strcmp(w[0]->args[0], w[0]->args[1]) != 0) {
+        return false;
+    }
+    replace_window(out, 1, NULL);
+    return true;
+}
+
+/* mov R, A; mov R, B => mov R, B, where B does not use R. */
+bool dead_mov(Vector* out, Insn** w) {
+    if (!is_op(w[0], "mov") || !is_op(w[1], "mov") || !is_reg(w[0]->args[0])) {
+        return false;
+    }
+    char* reg = w[0]->args[0];
+    if (strcmp(w[1]->args[0], reg) != 0 || names(w[1]->args[1], reg)) {
+        return false;
+    }
+    replace_window(out, 2, w[1]);
+    return true;
+}
+
+/* mov A, B; mov B, A => mov A, B */
+bool mov_back(Vector* out, Insn** w) {
+    if (!is_op(w[0], "mov") || !is_op(w[1], "mov")) {
+        return false;
+    }
+    if (strcmp(w[0]->args[0], w[1]->args[1]) || strcmp(w[0]->args[1], w[1]->args[0])) {
+        return false;
+    }
+    replace_window(out, 2, w[0]);
+    return true;
+}
+
+/* mov R, rbp; sub R, N; mov R, [R] => mov R, [rbp-N] */
+bool address_load(Vector* out, Insn** w) {
+    if (!is_op(w[0], "mov") || !is_op(w[1], "sub") || !is_op(w[2], "mov")) {
+        return false;
+    }
+    char* reg = w[0]->args[0];
+    if (strcmp(w[0]->args[1], "rbp") || strcmp(w[1]->args[0], reg) || !is_imm(w[1]->args[1]) ||
+        strcmp(w[2]->args[0], reg)) {
+        return false;
+    }
+    char* addr = calloc(1, strlen(reg) + 3);
+    sprintf(addr, "[%s]", reg);
+    bool loads = strcmp(w[2]->args[1], addr) == 0;
+    free(addr);
+    if (!loads) {
+        return false;
+    }
+    char* mem = calloc(1, strlen(w[1]->args[1]) + 8);
+    sprintf(mem, "[rbp-%s]", w[1]->args[1]);
+    replace_window(out, 3, new_insn("mov", reg, mem));
+    return true;
+}
+
+/* ret; I => ret, and jmp L; I => jmp L, since nothing jumps to I without a label. */
+bool unreachable(Vector* out, Insn** w) {
+    if ((!is_op(w[0], "ret") && !is_op(w[0], "jmp")) || !w[1]->op) {
+        return false;
+    }
+    replace_window(out, 2, w[0]);
+    return true;
+}
+
+PeepholeRule rules[] = {
+    {"push-pop", 2, push_pop},
+    {"push-op-pop", 3, push_op_pop},
+    {"mov-self", 1, mov_self},
+    {"dead-mov", 2, dead_mov},
+    {"mov-back", 2, mov_back},
+    {"address-load", 3, address_load},
+    {"unreachable", 2, unreachable},
+};
+
+#define RULE_COUNT (int)(sizeof(rules) / sizeof(rules[0]))
+
+/* Returns `insns` rewritten by the rules, and adds up the hits of each rule if `count` is true. */
+Vector* rewrite_insns(Vector* insns, bool count) {
+    Vector* out = create_vector();
+    for (int i = 0; i < insns->len; i++) {
+        vec_push(out, insns->data[i]);
+        for (int j = 0; j < RULE_COUNT; j++) {
+            PeepholeRule* rule = &rules[j];
+            if (out->len < rule->width) {
+                continue;
+            }
+            Insn** window = (Insn**)out->data + out->len - rule->width;
+            bool labeled = false;
+            for (int k = 0; k < rule->width; k++) {
+                labeled = labeled || !window[k]->op;
+            }
+            if (!labeled && rule->rewrite(out, window)) {
+                if (count) {
+                    rule->hits++;
+                }
+                /* Try every rule again on the new end of the output. */
+                j = -1;
+            }
+        }
+    }
+    free(insns->data);
+    free(insns);
+    return out;
+}
+
+/* Returns `insns` rewritten by the rules, and counts the hits of each rule. */
+Vector* peephole(Vector* insns) {
+    for (int i = 0; i < RULE_COUNT; i++) {
+        rules[i].hits = 0;
+    }
+    return rewrite_insns(insns, true);
+}
+
+void print_peephole_stats(FILE* out) {
+    for (int i = 0; i < RULE_COUNT; i++) {
+        if (rules[i].hits > 0) {
+            fprintf(out, "peephole: %s %d\n", rules[i].name, rules[i].hits);
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "insn.h"
+#include "vector.h"
+
+/* Rewrite of the last `width` instructions of the output, if they match. */
+typedef struct {
+    char* name;
+    int width;
+    bool (*rewrite)(Vector* out, Insn** window);
+    int hits;
+} PeepholeRule;
+
+Vector* rewrite_insns(Vector* insns, bool count);
+
+Vector* peephole(Vector* insns);
+
+void print_peephole_stats(FILE* out);
+
+#endif // !PEEPHOLE_H
@@ -0,0 +1,239 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ir.h"
+#include "regalloc.h"
+#include "vector.h"
+#include "x86.h"
+
+/*
+ * Register allocation.
+ *
+ * Instructions are numbered in the order of the blocks, and each virtual register lives from the
+ * instruction defining it to its last use, widened to the ends of the blocks it is live across.
+ * Liveness across blocks comes from backward dataflow over their successors, where a phi uses
+ * its argument at the end of the matching predecessor.
+ */
+
+/* Calls `f` with each register `ir` reads. */
+void for_each_use(Ir* ir, void (*f)(int reg, void* arg), void* arg) {
+    if (ir->kind == IR_PHI) {
+        return; // Used at the end of the predecessors instead.
+    }
+    if (ir->lhs) {
+        f(ir->lhs, arg);
+    }
+    if (ir->rhs) {
+        f(ir->rhs, arg);
+    }
+}
+
+void mark_live(int reg, void* live) { ((bool*)live)[reg] = true; }
+
+/* Computes the live-in set of `block` into `live`, which holds its live-out set. */
+void transfer(Block* block, bool* live) {
+    for (int i = block->irs->len - 1; i >= 0; i--) {
+        Ir* ir = block->irs->data[i];
+        if (ir->dst) {
+            live[ir->dst] = false;
+        }
+        for_each_use(ir, mark_live, live);
+    }
+}
+
+/* Computes the live-out set of `block` into `live`. */
+void block_live_out(Block* block, bool** live_in, int reg_count, bool* live) {
+    for (int i = 0; i <= reg_count; i++) {
+        live[i] = false;
+    }
+    for (int i = 0; i < block->succs->len; i++) {
+        Block* succ = block->succs->data[i];
+        for (int j = 0; j <= reg_count; j++) {
+            live[j] = live[j] || live_in[succ->id][j];
+        }
+        /* The phis of `succ` read the argument coming from `block`. */
+        int pred = 0;
+        while (succ->preds->data[pred] != block) {
+            pred++;
+        }
+        for (int j = 0; j < succ->irs->len; j++) {
+            Ir* ir = succ->irs->data[j];
+            if (ir->kind == IR_PHI) {
+                live[(int)(long)ir->args->data[pred]] = true;
+            }
+        }
+    }
+}
+
+void extend(Interval* interval, int pos) {
+    if (interval->start < 0 || pos < interval->start) {
+        interval->start = pos;
+    }
+    if (pos > interval->end) {
+        interval->end = pos;
+    }
+}
+
+typedef struct {
+    Interval* intervals;
+    int pos;
+} UseSite;
+
+void extend_use(int reg, void* site) {
+    UseSite* use = site;
+    extend(&use->intervals[reg], use->pos);
+}
+
+/* Returns the live-in set of every block, by block id. */
+bool** block_live_in(IrProgram* prog) {
+    int reg_count = prog->reg_count;
+    int block_count = prog->blocks->len;
+    bool** live_in = calloc(block_count, sizeof(bool*));
+    for (int i = 0; i < block_count; i++) {
+        live_in[i] = calloc(reg_count + 1, sizeof(bool));
+    }
+    bool* live = calloc(reg_count + 1, sizeof(bool));
+
+    /* Live-in sets only grow, so this ends. Visiting backward converges fast without loops. */
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = block_count - 1; i >= 0; i--) {
+            Block* block = prog->blocks->data[i];
+            block_live_out(block, live_in, reg_count, live);
+            transfer(block, live);
+            for (int j = 0; j <= reg_count; j++) {
+                changed = changed || live[j] != live_in[i][j];
+                live_in[i][j] = live[j];
+            }
+        }
+    }
+    free(live);
+    return live_in;
+}
+
+void free_live_in(IrProgram* prog, bool** live_in) {
+    for (int i = 0; i < prog->blocks->len; i++) {
+        free(live_in[i]);
+    }
+    free(live_in);
+}
+
+/* Returns the interval of every register, where `start` is -1 for the ones never defined. */
+Interval* live_intervals(IrProgram* prog) {
+    int reg_count = prog->reg_count;
+    int block_count = prog->blocks->len;
+    bool** live_in = block_live_in(prog);
+    bool* live = calloc(reg_count + 1, sizeof(bool));
+
+    Interval* intervals = calloc(reg_count + 1, sizeof(Interval));
+    for (int i = 0; i <= reg_count; i++) {
+        intervals[i] = (Interval){i, -1, -1};
+    }
+    int pos = 0;
+    for (int i = 0; i < block_count; i++) {
+        Block* block = prog->blocks->data[i];
+        int first = pos;
+        for (int j = 0; j < block->irs->len; j++, pos++) {
+            Ir* ir = block->irs->data[j];
+            UseSite site = {intervals, pos};
+            for_each_use(ir, extend_use, &site);
+            if (ir->dst) {
+                extend(&intervals[ir->dst], pos);
+            }
+        }
+        int last = pos - 1;
+        block_live_out(block, live_in, reg_count, live);
+        for (int reg = 1; reg <= reg_count; reg++) {
+            if (live_in[i][reg]) {
+                extend(&intervals[reg], first);
+            }
+            if (live[reg]) {
+                extend(&intervals[reg], last);
+            }
+        }
+    }
+
+    free_live_in(prog, live_in);
+    free(live);
+    return intervals;
+}
+
+int by_start(const void* a, const void* b) {
+    const Interval* x = a;
+    const Interval* y = b;
+    return x->start != y->start ? x->start - y->start : x->reg - y->reg;
+}
+
+Allocation* new_allocation(int reg_count) {
+    Allocation* alloc = calloc(1, sizeof(Allocation));
+    alloc->regs = calloc(reg_count + 1, sizeof(int));
+    alloc->slots = calloc(reg_count + 1, sizeof(int));
+    for (int i = 0; i <= reg_count; i++) {
+        alloc->regs[i] = -1;
+    }
+    return alloc;
+}
+
+void spill(Allocation* alloc, int reg) {
+    alloc->regs[reg] = -1;
+    alloc->slots[reg] = ++alloc->slot_count;
+    alloc->spilled++;
+}
+
+/*
+ * Linear scan by Poletto and Sarkar. Intervals are visited by increasing start, and the ones
+ * that ended give their physical registers back. When none is free, the interval that ends last
+ * among the current one and the active ones is spilled to the stack.
+ *
+ * An interval may start where another ends, since instructions read their operands before they
+ * write their result.
+ */
+Allocation* linear_scan(IrProgram* prog) {
+    Interval* intervals = live_intervals(prog);
+    Allocation* alloc = new_allocation(prog->reg_count);
+
+    bool* unplaced = unplaced_regs(prog);
+    int len = 0;
+    for (int i = 1; i <= prog->reg_count; i++) {
+        if (intervals[i].start >= 0 && !unplaced[i]) {
+            intervals[len++] = intervals[i];
+        }
+    }
+    free(unplaced);
+    qsort(intervals, len, sizeof(Interval), by_start);
+
+    /* Intervals holding a physical register, by register index. */
+    Interval* active[ALLOC_REG_COUNT] = {0};
+    for (int i = 0; i < len; i++) {
+        Interval* current = &intervals[i];
+        int free_reg = -1;
+        int last = -1;
+        for (int r = 0; r < ALLOC_REG_COUNT; r++) {
+            if (active[r] && active[r]->end <= current->start) {
+                active[r] = NULL;
+            }
+            if (!active[r]) {
+                free_reg = free_reg < 0 ? r : free_reg;
+            } else if (last < 0 || active[r]->end > active[last]->end) {
+                last = r;
+            }
+        }
+
+        if (free_reg < 0 && active[last]->end > current->end) {
+            /* The active interval ending last gives its register up. */
+            spill(alloc, active[last]->reg);
+            free_reg = last;
+        }
+        if (free_reg < 0) {
+            spill(alloc, current->reg);
+            continue;
+        }
+        active[free_reg] = current;
+        alloc->regs[current->reg] = free_reg;
+        alloc->used |= 1 << free_reg;
+    }
+
+    free(intervals);
+    return alloc;
+}
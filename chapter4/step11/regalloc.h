@@ -0,0 +1,41 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdbool.h>
+
+#include "ir.h"
+
+/* Number of physical registers given to virtual registers, see x86.c. */
+#define ALLOC_REG_COUNT 5
+
+/* Instructions of `reg` from its definition to its last use, in the order of the blocks. */
+typedef struct {
+    int reg;
+    int start;
+    int end;
+} Interval;
+
+/* Place of each virtual register. */
+typedef struct {
+    int* regs;  // Physical register index, -1 if spilled or unused.
+    int* slots; // Stack slot of a spilled register, numbered from 1, 0 if none.
+    int slot_count;
+    int spilled; // Virtual registers in stack slots, which may share them.
+    int used; // Bit mask of the physical registers used.
+} Allocation;
+
+void for_each_use(Ir* ir, void (*f)(int reg, void* arg), void* arg);
+
+void block_live_out(Block* block, bool** live_in, int reg_count, bool* live);
+
+bool** block_live_in(IrProgram* prog);
+
+void free_live_in(IrProgram* prog, bool** live_in);
+
+Allocation* new_allocation(int reg_count);
+
+Interval* live_intervals(IrProgram* prog);
+
+Allocation* linear_scan(IrProgram* prog);
+
+#endif // !REGALLOC_H
@@ -0,0 +1,160 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "fold.h"
+#include "ir.h"
+#include "map.h"
+#include "sccp.h"
+#include "vector.h"
+
+/*
+ * Sparse conditional constant propagation, by Wegman and Zadeck.
+ *
+ * Every register starts VAL_UNKNOWN and only moves down to VAL_CONST and VAL_VARYING. Blocks are
+ * visited once they are found executable, and an instruction is visited again whenever the value
+ * of one of its operands moves down, along the def-use edges of the SSA form. At the end every
+ * register that is VAL_CONST is computed by an IR_IMM instead.
+ *
+ * A block is executable if the entry reaches it. `ret` has no successors, so for now the blocks
+ * after a `return` are never visited. A conditional branch will follow only the edges that its
+ * condition allows, and phis will merge only the values of executable predecessors.
+ */
+
+/* Lowers the value of `reg` to `value`, and queues the users of `reg` if it moved. */
+void lower_value(Sccp* sccp, int reg, Value value) {
+    Value* old = &sccp->values[reg];
+    if (old->state == value.state && (value.state != VAL_CONST || old->val == value.val)) {
+        return;
+    }
+    *old = value;
+    Vector* users = sccp->users[reg];
+    for (int i = 0; i < users->len; i++) {
+        vec_push(sccp->ssa_work, users->data[i]);
+    }
+}
+
+/* Evaluates `ir` with the current values of its operands. */
+Value evaluate(Sccp* sccp, Ir* ir) {
+    switch (ir->kind) {
+    case IR_IMM:
+        return (Value){VAL_CONST, ir->val};
+    case IR_BIN: {
+        Value lhs = sccp->values[ir->lhs];
+        Value rhs = sccp->values[ir->rhs];
+        long val;
+        if (lhs.state == VAL_VARYING || rhs.state == VAL_VARYING) {
+            return (Value){VAL_VARYING, 0};
+        }
+        if (lhs.state == VAL_UNKNOWN || rhs.state == VAL_UNKNOWN) {
+            return (Value){VAL_UNKNOWN, 0};
+        }
+        /* A division that traps is left for runtime. */
+        if (!eval_binary(ir->op, lhs.val, rhs.val, &val)) {
+            return (Value){VAL_VARYING, 0};
+        }
+        return (Value){VAL_CONST, val};
+    }
+    case IR_PHI: {
+        Block* block = map_get(sccp->blocks, ir);
+        Value merged = {VAL_UNKNOWN, 0};
+        for (int i = 0; i < ir->args->len; i++) {
+            Block* pred = block->preds->data[i];
+            Value arg = sccp->values[(int)(long)ir->args->data[i]];
+            if (!sccp->executable[pred->id] || arg.state == VAL_UNKNOWN) {
+                continue;
+            }
+            if (merged.state == VAL_UNKNOWN) {
+                merged = arg;
+            } else if (arg.state == VAL_VARYING || arg.val != merged.val) {
+                merged.state = VAL_VARYING;
+            }
+        }
+        return merged;
+    }
+    default:
+        /* Loads read memory that is not known here. */
+        return (Value){VAL_VARYING, 0};
+    }
+}
+
+void visit(Sccp* sccp, Ir* ir) {
+    if (ir->dst) {
+        lower_value(sccp, ir->dst, evaluate(sccp, ir));
+    }
+}
+
+void add_user(Sccp* sccp, int reg, Ir* ir) {
+    if (reg) {
+        vec_push(sccp->users[reg], ir);
+    }
+}
+
+void propagate_constants(IrProgram* prog) {
+    Sccp* sccp = calloc(1, sizeof(Sccp));
+    sccp->values = calloc(prog->reg_count + 1, sizeof(Value));
+    sccp->users = calloc(prog->reg_count + 1, sizeof(Vector*));
+    for (int i = 0; i <= prog->reg_count; i++) {
+        sccp->users[i] = create_vector();
+    }
+    sccp->blocks = create_map();
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            map_put(sccp->blocks, ir, block);
+            add_user(sccp, ir->lhs, ir);
+            add_user(sccp, ir->rhs, ir);
+            for (int k = 0; ir->args && k < ir->args->len; k++) {
+                add_user(sccp, (int)(long)ir->args->data[k], ir);
+            }
+        }
+    }
+    sccp->executable = calloc(prog->blocks->len, sizeof(bool));
+    sccp->ssa_work = create_vector();
+
+    Vector* block_work = create_vector();
+    vec_push(block_work, prog->blocks->data[0]);
+    while (block_work->len > 0 || sccp->ssa_work->len > 0) {
+        if (block_work->len > 0) {
+            Block* block = vec_pop(block_work);
+            if (sccp->executable[block->id]) {
+                continue;
+            }
+            sccp->executable[block->id] = true;
+            for (int i = 0; i < block->succs->len; i++) {
+                Block* succ = block->succs->data[i];
+                vec_push(block_work, succ);
+                /* Phis of a block already visited now merge one more predecessor. */
+                for (int j = 0; j < succ->irs->len; j++) {
+                    Ir* ir = succ->irs->data[j];
+                    if (ir->kind == IR_PHI) {
+                        vec_push(sccp->ssa_work, ir);
+                    }
+                }
+            }
+            for (int i = 0; i < block->irs->len; i++) {
+                visit(sccp, block->irs->data[i]);
+            }
+            continue;
+        }
+        Ir* ir = vec_pop(sccp->ssa_work);
+        Block* block = map_get(sccp->blocks, ir);
+        if (sccp->executable[block->id]) {
+            visit(sccp, ir);
+        }
+    }
+
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; sccp->executable[i] && j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            if (ir->dst && sccp->values[ir->dst].state == VAL_CONST) {
+                ir->kind = IR_IMM;
+                ir->val = sccp->values[ir->dst].val;
+                ir->lhs = 0;
+                ir->rhs = 0;
+                ir->args = NULL;
+            }
+        }
+    }
+}
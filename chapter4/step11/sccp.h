@@ -0,0 +1,32 @@
+#ifndef SCCP_H
+#define SCCP_H
+
+#include <stdbool.h>
+
+#include "ir.h"
+#include "map.h"
+#include "vector.h"
+
+typedef enum {
+    VAL_UNKNOWN, // Not computed by any executable instruction yet.
+    VAL_CONST,   // Always `val`.
+    VAL_VARYING, // Not known at compile time.
+} ValueState;
+
+typedef struct {
+    ValueState state;
+    long val;
+} Value;
+
+/* State of propagate_constants, indexed by register and block id. */
+typedef struct {
+    Value* values;
+    Vector** users;
+    Map* blocks; // Block of each instruction.
+    bool* executable;
+    Vector* ssa_work;
+} Sccp;
+
+void propagate_constants(IrProgram* prog);
+
+#endif // !SCCP_H
@@ -0,0 +1,635 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "error.h"
+#include "insn.h"
+#include "node.h"
+#include "select.h"
+#include "vector.h"
+
+/*
+ * Instruction selection by tree pattern matching.
+ *
+ * Each rule of the table below rewrites a pattern of nodes, whose leaves are reduced to
+ * nonterminals first, to a nonterminal at a cost. label_tree() finds bottom up the cheapest rule
+ * reducing each node to each nonterminal, so that the rules chosen from the root down are the
+ * cheapest cover of the tree, and reduce_tree() emits their code. Only the table knows x86: the
+ * matcher takes any patterns, and a new instruction is a new rule.
+ *
+ * ex. `a+b*4+8` is cheapest as one `lea`, where `b*4` is an index, `a+b*4` a base and an index,
+ * and `+8` the displacement of the address:
+ *
+ *   mov rsi, qword ptr [rsp-16]
+ *   mov r8, qword ptr [rsp-8]
+ *   lea rsi, [rsi+r8*4+8]
+ *
+ * Values are kept on a stack of the registers of expr_regs, where the value at depth d lives in
+ * expr_regs[d % EXPR_REG_COUNT]. Only when the stack is deeper than the registers, the value
+ * EXPR_REG_COUNT below the new one goes to the machine stack, and comes back when the new one is
+ * consumed. The leaves of each rule are reduced first when they need more registers, by the
+ * numbering of Sethi and Ullman, so that a tree needs as few of them as possible at once. Leaves
+ * containing an assignment keep the order of the source instead, which the other backends follow.
+ */
+
+/* Caller-saved registers not used by the templates of generate_binary() and by_constant(). */
+char* expr_regs[EXPR_REG_COUNT] = {"rsi", "r8", "r9", "r10", "r11"};
+
+char* expr_reg(int depth) { return expr_regs[depth % EXPR_REG_COUNT]; }
+
+/* Returns the register of a new value on top of the stack. */
+char* push_value(ExprStack* stack) {
+    int depth = stack->depth++;
+    if (depth >= EXPR_REG_COUNT) {
+        emit("  push %s\n", expr_reg(depth));
+    }
+    return expr_reg(depth);
+}
+
+/* Drops the top value, and reloads the one that gave its register up. */
+void pop_value(ExprStack* stack) {
+    int depth = --stack->depth;
+    if (depth >= EXPR_REG_COUNT) {
+        emit("  pop %s\n", expr_reg(depth));
+    }
+}
+
+char* format(char* fmt, char* a, char* b) {
+    char* text = calloc(1, strlen(fmt) + strlen(a) + strlen(b) + 1);
+    sprintf(text, fmt, a, b);
+    return text;
+}
+
+/* Emits `mov dst, src` unless they are the same register. */
+void move_value(char* dst, char* src) {
+    if (strcmp(dst, src) != 0) {
+        emit("  mov %s, %s\n", dst, src);
+    }
+}
+
+/* Computes `dst` = `lhs` `kind` `rhs` by generate_binary(), where `dst` is a register of lhs or
+ * rhs, or a new one. */
+void emit_binary(NodeKind kind, char* dst, char* lhs, char* rhs) {
+    if (strcmp(dst, lhs) == 0) {
+        generate_binary(kind, dst, rhs);
+    } else if (strcmp(dst, rhs) != 0) {
+        emit("  mov %s, %s\n", dst, lhs);
+        generate_binary(kind, dst, rhs);
+    } else if (is_commutative(kind)) {
+        generate_binary(kind, dst, lhs);
+    } else {
+        /* `lhs` is then the other register. */
+        generate_binary(kind, lhs, rhs);
+        emit("  mov %s, %s\n", dst, lhs);
+    }
+}
+
+/* Condition code of the comparison `kind`, or of its mirror when the operands are swapped. */
+char* condition_code(NodeKind kind, bool mirrored) {
+    switch (kind) {
+    case ND_EQ:
+        return "e";
+    case ND_NEQ:
+        return "ne";
+    case ND_LT:
+        return mirrored ? "g" : "l";
+    default:
+        return mirrored ? "ge" : "le";
+    }
+}
+
+char* emit_number(Node* node, char** kids, char* dst) {
+    char* text = calloc(1, 24);
+    sprintf(text, "%ld", node->val);
+    return text;
+}
+
+char* emit_variable(Node* node, char** kids, char* dst) { return local_operand(node); }
+
+char* emit_mov_number(Node* node, char** kids, char* dst) {
+    emit("  mov %s, %ld\n", dst, node->val);
+    return NULL;
+}
+
+char* emit_load(Node* node, char** kids, char* dst) {
+    emit("  mov %s, %s\n", dst, kids[0]);
+    return NULL;
+}
+
+char* emit_operator(Node* node, char** kids, char* dst) {
+    emit_binary(node->kind, dst, kids[0], kids[1]);
+    return NULL;
+}
+
+char* emit_by_constant(Node* node, char** kids, char* dst) {
+    move_value(dst, kids[0]);
+    generate_by_constant(node->kind, dst, atol(kids[1]));
+    return NULL;
+}
+
+char* emit_mul_power(Node* node, char** kids, char* dst) {
+    move_value(dst, kids[0]);
+    generate_by_constant(ND_SHL, dst, log2_abs(atol(kids[1])));
+    return NULL;
+}
+
+char* emit_imul_immediate(Node* node, char** kids, char* dst) {
+    emit("  imul %s, %s, %s\n", dst, kids[0], kids[1]);
+    return NULL;
+}
+
+/* `x op 0` by `test`, which sets the flags like `cmp x, 0` with a shorter encoding. */
+char* emit_test(Node* node, char** kids, char* dst) {
+    emit("  test %s, %s\n", kids[0], kids[0]);
+    emit("  set%s al\n", condition_code(node->kind, false));
+    emit("  movzb %s, al\n", dst);
+    return NULL;
+}
+
+/* `0 op x` by `test`, with the condition of `x mirrored-op 0`. */
+char* emit_test_mirrored(Node* node, char** kids, char* dst) {
+    emit("  test %s, %s\n", kids[1], kids[1]);
+    emit("  set%s al\n", condition_code(node->kind, true));
+    emit("  movzb %s, al\n", dst);
+    return NULL;
+}
+
+char* emit_neg(Node* node, char** kids, char* dst) {
+    move_value(dst, kids[1]);
+    emit("  neg %s\n", dst);
+    return NULL;
+}
+
+char* emit_index(Node* node, char** kids, char* dst) {
+    return strcmp(kids[1], "1") == 0 ? kids[0] : format("%s*%s", kids[0], kids[1]);
+}
+
+char* emit_shifted_index(Node* node, char** kids, char* dst) {
+    char scale[2] = {'0' + (1 << atoi(kids[1])), '\0'};
+    return emit_index(node, (char*[]){kids[0], scale}, dst);
+}
+
+char* emit_sum(Node* node, char** kids, char* dst) { return format("%s+%s", kids[0], kids[1]); }
+
+/* Adds the displacement `kids[1]`, negated for a subtraction. */
+char* emit_displacement(Node* node, char** kids, char* dst) {
+    char* disp = calloc(1, 24);
+    long val = atol(kids[1]);
+    sprintf(disp, "%+ld", node->kind == ND_SUB ? -val : val);
+    return format("%s%s", kids[0], disp);
+}
+
+char* emit_lea(Node* node, char** kids, char* dst) {
+    emit("  lea %s, [%s]\n", dst, kids[0]);
+    return NULL;
+}
+
+char* emit_store(Node* node, char** kids, char* dst) {
+    emit("  mov %s, %s\n", kids[0], kids[1]);
+    return NULL;
+}
+
+/* `a = a op x` by `op a, x`, which reads and writes the variable in memory. */
+char* emit_update(Node* node, char** kids, char* dst) {
+    generate_binary(node->rhs->kind, kids[0], kids[1]);
+    return NULL;
+}
+
+/* Chain rules between operands keep the operand of their leaf. */
+char* emit_operand(Node* node, char** kids, char* dst) { return kids[0]; }
+
+bool accepts_imm32(Node* node, Node* lhs, Node* rhs) { return is_imm32(node); }
+
+bool accepts_zero(Node* node, Node* lhs, Node* rhs) { return node->val == 0; }
+
+bool accepts_scale(Node* node, Node* lhs, Node* rhs) {
+    return node->val == 1 || node->val == 2 || node->val == 4 || node->val == 8;
+}
+
+bool accepts_shift(Node* node, Node* lhs, Node* rhs) { return node->val >= 0 && node->val <= 3; }
+
+/* Multiplications that `lea` does as base + base * (n - 1). */
+bool accepts_lea_factor(Node* node, Node* lhs, Node* rhs) {
+    return rhs->val == 3 || rhs->val == 5 || rhs->val == 9;
+}
+
+bool accepts_power(Node* node, Node* lhs, Node* rhs) {
+    return rhs->val > 0 && log2_abs(rhs->val) > 0;
+}
+
+bool accepts_shift_count(Node* node, Node* lhs, Node* rhs) {
+    return by_constant(ND_SHL, rhs->val);
+}
+
+bool accepts_divide_power(Node* node, Node* lhs, Node* rhs) {
+    return by_constant(ND_DIV, rhs->val) && log2_abs(rhs->val);
+}
+
+bool accepts_divide_magic(Node* node, Node* lhs, Node* rhs) {
+    return by_constant(ND_DIV, rhs->val) && !log2_abs(rhs->val);
+}
+
+/* Displacements negated for subtractions stay within 32 bits. */
+bool accepts_negatable(Node* node, Node* lhs, Node* rhs) { return rhs->val != INT_MIN; }
+
+/* Assignments of the variable plus or minus something to itself. */
+bool accepts_update(Node* node, Node* lhs, Node* rhs) {
+    return (rhs->kind == ND_ADD || rhs->kind == ND_SUB) && rhs->lhs->kind == ND_LVAR &&
+           rhs->lhs->lvar == lhs->lvar;
+}
+
+#define LHS(nt) {"l", nt}
+#define RHS(nt) {"r", nt}
+#define SELF(nt) {"", nt}
+
+/*
+ * The rules, in the order that breaks ties of cost. Each instruction costs 4, plus 1 for an
+ * immediate or memory operand, which lengthens its encoding, plus 4 for each cycle of latency
+ * past the first: 2 for `imul` and about 20 for `idiv`.
+ */
+Rule select_rules[] = {
+    /* Operands. */
+    {NT_CONST, ND_NUM, {}, 0, false, NULL, emit_number},
+    {NT_IMM, ND_NUM, {}, 0, false, accepts_imm32, emit_number},
+    {NT_ZERO, ND_NUM, {}, 0, false, accepts_zero, emit_number},
+    {NT_SCALE, ND_NUM, {}, 0, false, accepts_scale, emit_number},
+    {NT_SHIFT, ND_NUM, {}, 0, false, accepts_shift, emit_number},
+    {NT_MEM, ND_LVAR, {}, 0, false, NULL, emit_variable},
+    {NT_REG, ND_NUM, {}, 5, false, NULL, emit_mov_number},
+    {NT_REG, CHAIN, {SELF(NT_MEM)}, 5, false, NULL, emit_load},
+    {NT_STMT, CHAIN, {SELF(NT_REG)}, 0, false, NULL, emit_operand},
+
+    /* Arithmetic, with constants and variables as operands. */
+    {NT_REG, ND_ADD, {LHS(NT_REG), RHS(NT_REG)}, 4, true, NULL, emit_operator},
+    {NT_REG, ND_ADD, {LHS(NT_REG), RHS(NT_IMM)}, 5, true, NULL, emit_operator},
+    {NT_REG, ND_ADD, {LHS(NT_REG), RHS(NT_MEM)}, 5, true, NULL, emit_operator},
+    {NT_REG, ND_SUB, {LHS(NT_REG), RHS(NT_REG)}, 4, false, NULL, emit_operator},
+    {NT_REG, ND_SUB, {LHS(NT_REG), RHS(NT_IMM)}, 5, false, NULL, emit_operator},
+    {NT_REG, ND_SUB, {LHS(NT_REG), RHS(NT_MEM)}, 5, false, NULL, emit_operator},
+    {NT_REG, ND_SUB, {LHS(NT_ZERO), RHS(NT_REG)}, 4, false, NULL, emit_neg},
+    {NT_REG, ND_MUL, {LHS(NT_REG), RHS(NT_REG)}, 12, true, NULL, emit_operator},
+    {NT_REG, ND_MUL, {LHS(NT_REG), RHS(NT_MEM)}, 13, true, NULL, emit_operator},
+    {NT_REG, ND_MUL, {LHS(NT_REG), RHS(NT_IMM)}, 13, true, NULL, emit_imul_immediate},
+    {NT_REG, ND_MUL, {LHS(NT_MEM), RHS(NT_IMM)}, 14, true, NULL, emit_imul_immediate},
+    {NT_REG, ND_MUL, {LHS(NT_REG), RHS(NT_IMM)}, 4, true, accepts_lea_factor, emit_by_constant},
+    {NT_REG, ND_MUL, {LHS(NT_REG), RHS(NT_IMM)}, 5, true, accepts_power, emit_mul_power},
+    {NT_REG, ND_SHL, {LHS(NT_REG), RHS(NT_REG)}, 8, false, NULL, emit_operator},
+    {NT_REG, ND_SHL, {LHS(NT_REG), RHS(NT_CONST)}, 5, false, accepts_shift_count,
+     emit_by_constant},
+    {NT_REG, ND_DIV, {LHS(NT_REG), RHS(NT_REG)}, 96, false, NULL, emit_operator},
+    {NT_REG, ND_DIV, {LHS(NT_REG), RHS(NT_MEM)}, 97, false, NULL, emit_operator},
+    {NT_REG, ND_DIV, {LHS(NT_REG), RHS(NT_CONST)}, 36, false, accepts_divide_power,
+     emit_by_constant},
+    {NT_REG, ND_DIV, {LHS(NT_REG), RHS(NT_CONST)}, 51, false, accepts_divide_magic,
+     emit_by_constant},
+
+    /* Comparisons, where `test` compares with 0. */
+    {NT_REG, ND_EQ, {LHS(NT_REG), RHS(NT_REG)}, 12, true, NULL, emit_operator},
+    {NT_REG, ND_EQ, {LHS(NT_REG), RHS(NT_IMM)}, 13, true, NULL, emit_operator},
+    {NT_REG, ND_EQ, {LHS(NT_REG), RHS(NT_MEM)}, 13, true, NULL, emit_operator},
+    {NT_REG, ND_EQ, {LHS(NT_REG), RHS(NT_ZERO)}, 12, true, NULL, emit_test},
+    {NT_REG, ND_NEQ, {LHS(NT_REG), RHS(NT_REG)}, 12, true, NULL, emit_operator},
+    {NT_REG, ND_NEQ, {LHS(NT_REG), RHS(NT_IMM)}, 13, true, NULL, emit_operator},
+    {NT_REG, ND_NEQ, {LHS(NT_REG), RHS(NT_MEM)}, 13, true, NULL, emit_operator},
+    {NT_REG, ND_NEQ, {LHS(NT_REG), RHS(NT_ZERO)}, 12, true, NULL, emit_test},
+    {NT_REG, ND_LT, {LHS(NT_REG), RHS(NT_REG)}, 12, false, NULL, emit_operator},
+    {NT_REG, ND_LT, {LHS(NT_REG), RHS(NT_IMM)}, 13, false, NULL, emit_operator},
+    {NT_REG, ND_LT, {LHS(NT_REG), RHS(NT_MEM)}, 13, false, NULL, emit_operator},
+    {NT_REG, ND_LT, {LHS(NT_REG), RHS(NT_ZERO)}, 12, false, NULL, emit_test},
+    {NT_REG, ND_LT, {LHS(NT_ZERO), RHS(NT_REG)}, 12, false, NULL, emit_test_mirrored},
+    {NT_REG, ND_LTE, {LHS(NT_REG), RHS(NT_REG)}, 12, false, NULL, emit_operator},
+    {NT_REG, ND_LTE, {LHS(NT_REG), RHS(NT_IMM)}, 13, false, NULL, emit_operator},
+    {NT_REG, ND_LTE, {LHS(NT_REG), RHS(NT_MEM)}, 13, false, NULL, emit_operator},
+    {NT_REG, ND_LTE, {LHS(NT_REG), RHS(NT_ZERO)}, 12, false, NULL, emit_test},
+    {NT_REG, ND_LTE, {LHS(NT_ZERO), RHS(NT_REG)}, 12, false, NULL, emit_test_mirrored},
+
+    /* Addresses, which `lea` computes in one instruction. */
+    {NT_INDEX, CHAIN, {SELF(NT_REG)}, 0, false, NULL, emit_operand},
+    {NT_INDEX, ND_MUL, {LHS(NT_REG), RHS(NT_SCALE)}, 0, true, NULL, emit_index},
+    {NT_INDEX, ND_SHL, {LHS(NT_REG), RHS(NT_SHIFT)}, 0, false, NULL, emit_shifted_index},
+    {NT_BASE_DISP, ND_ADD, {LHS(NT_REG), RHS(NT_IMM)}, 0, true, NULL, emit_displacement},
+    {NT_BASE_DISP, ND_SUB, {LHS(NT_REG), RHS(NT_IMM)}, 0, false, accepts_negatable,
+     emit_displacement},
+    {NT_BASE_INDEX, ND_ADD, {LHS(NT_REG), RHS(NT_INDEX)}, 0, true, NULL, emit_sum},
+    {NT_ADDRESS, ND_ADD, {LHS(NT_BASE_INDEX), RHS(NT_IMM)}, 0, true, NULL, emit_displacement},
+    {NT_ADDRESS, ND_SUB, {LHS(NT_BASE_INDEX), RHS(NT_IMM)}, 0, false, accepts_negatable,
+     emit_displacement},
+    {NT_ADDRESS, ND_ADD, {LHS(NT_BASE_DISP), RHS(NT_INDEX)}, 0, true, NULL, emit_sum},
+    {NT_REG, CHAIN, {SELF(NT_BASE_INDEX)}, 4, false, NULL, emit_lea},
+    {NT_REG, CHAIN, {SELF(NT_ADDRESS)}, 5, false, NULL, emit_lea},
+
+    /* Assignments, which update variables in memory. */
+    {NT_REG, ND_ASSIGN, {LHS(NT_MEM), RHS(NT_REG)}, 5, false, NULL, emit_store},
+    {NT_STMT, ND_ASSIGN, {LHS(NT_MEM), RHS(NT_IMM)}, 6, false, NULL, emit_store},
+    {NT_STMT, ND_ASSIGN, {LHS(NT_MEM), {"rr", NT_IMM}}, 6, false, accepts_update, emit_update,
+     true},
+    {NT_STMT, ND_ASSIGN, {LHS(NT_MEM), {"rr", NT_REG}}, 5, false, accepts_update, emit_update,
+     true},
+};
+
+/* Rules by the kind of their root, at kind + 1 so that CHAIN comes first. */
+Vector* rules_of[ND_NUM + 2];
+
+Vector* rules_of_kind(int kind) {
+    if (!rules_of[0]) {
+        for (int i = 0; i < ND_NUM + 2; i++) {
+            rules_of[i] = create_vector();
+        }
+        for (int i = 0; i < sizeof(select_rules) / sizeof(Rule); i++) {
+            vec_push(rules_of[select_rules[i].kind + 1], &select_rules[i]);
+        }
+    }
+    return rules_of[kind + 1];
+}
+
+int leaf_count(Rule* rule) { return rule->leaves[1].path ? 2 : rule->leaves[0].path ? 1 : 0; }
+
+/* Returns the position of the state at `path` under the node at `pos`, with the children of the
+ * node swapped if `swapped`, or -1 if the tree has none. */
+int follow(State* states, int pos, char* path, bool swapped) {
+    for (int i = 0; path[i] && pos >= 0; i++) {
+        bool lhs = (path[i] == 'l') != (i == 0 && swapped);
+        pos = lhs ? states[pos].lhs : states[pos].rhs;
+    }
+    return pos;
+}
+
+/* Orders the leaves of the rule of `nt` at `pos` to reduce those needing more registers than
+ * they hold afterwards first, unless one assigns, and returns the registers the rule needs. */
+int order_leaves(State* states, int pos, Nonterm nt, int* order) {
+    State* state = &states[pos];
+    Rule* rule = state->rule[nt];
+    int count = leaf_count(rule);
+    int need[2];
+    int regs[2];
+    bool assigns = false;
+    for (int i = 0; i < count; i++) {
+        State* leaf = &states[follow(states, pos, rule->leaves[i].path, state->swapped[nt])];
+        need[i] = leaf->need[rule->leaves[i].nt];
+        regs[i] = leaf->regs[rule->leaves[i].nt];
+        order[i] = i;
+        assigns = assigns || leaf->impure;
+    }
+    /* Leaves with an assignment stay in source order, left to right like the other backends. */
+    bool second_first = assigns ? (rule->leaves[0].path[0] == 'l') == state->swapped[nt]
+                                : need[1] - regs[1] > need[0] - regs[0];
+    if (count == 2 && second_first) {
+        order[0] = 1;
+        order[1] = 0;
+    }
+    int most = 0;
+    int held = 0;
+    for (int i = 0; i < count; i++) {
+        int j = order[i];
+        most = held + need[j] > most ? held + need[j] : most;
+        held += regs[j];
+    }
+    state->regs[nt] = nt == NT_REG ? 1 : nt == NT_STMT ? 0 : held;
+    /* A value computed from no register takes a new one. */
+    if (nt == NT_REG && most == 0) {
+        most = 1;
+    }
+    return most;
+}
+
+/* Sets the registers needed for `nt` at `pos`, after those of the nonterminal it chains from. */
+void number_state(State* states, int pos, Nonterm nt, bool* done) {
+    State* state = &states[pos];
+    if (done[nt]) {
+        return;
+    }
+    done[nt] = true;
+    Rule* rule = state->rule[nt];
+    if (rule->kind == CHAIN) {
+        number_state(states, pos, rule->leaves[0].nt, done);
+    }
+    int order[2];
+    state->need[nt] = order_leaves(states, pos, nt, order);
+}
+
+/* Tries `rule` at `pos`, with the children swapped if `swapped`. */
+void match_rule(State* states, int pos, Rule* rule, bool swapped) {
+    State* state = &states[pos];
+    Node* node = state->node;
+    int lhs = swapped ? state->rhs : state->lhs;
+    int rhs = swapped ? state->lhs : state->rhs;
+    /* Swapped children are evaluated right to left, which is the same only if neither assigns
+     * or one is a constant. */
+    if (swapped && (states[lhs].impure || states[rhs].impure) &&
+        states[lhs].node->kind != ND_NUM && states[rhs].node->kind != ND_NUM) {
+        return;
+    }
+    if (rule->accepts && !rule->accepts(node, lhs >= 0 ? states[lhs].node : NULL,
+                                        rhs >= 0 ? states[rhs].node : NULL)) {
+        return;
+    }
+    long cost = rule->cost;
+    int leaves[2];
+    int count = leaf_count(rule);
+    for (int i = 0; i < count; i++) {
+        leaves[i] = follow(states, pos, rule->leaves[i].path, swapped);
+        if (leaves[i] < 0) {
+            return;
+        }
+        cost += states[leaves[i]].cost[rule->leaves[i].nt];
+    }
+    /* A variable operand is read by the instruction, after the other leaf, which must not
+     * assign it. The variable of an assignment is written instead, unless it is updated. */
+    for (int i = 0; i < count; i++) {
+        bool read = rule->leaves[i].nt == NT_MEM &&
+                    !(rule->kind == ND_ASSIGN && i == 0 && !rule->updates);
+        if (read && count == 2 && states[leaves[1 - i]].impure) {
+            return;
+        }
+    }
+    if (cost < state->cost[rule->nt]) {
+        state->cost[rule->nt] = cost;
+        state->rule[rule->nt] = rule;
+        state->swapped[rule->nt] = swapped;
+    }
+}
+
+/* Finds the cheapest rule reducing each node under `root` to each nonterminal. */
+Labels* label_tree(Node* root) {
+    Vector* nodes = postorder_nodes(root);
+    Vector* chains = rules_of_kind(CHAIN);
+    State* states = calloc(nodes->len, sizeof(State));
+    /* Positions of the subtrees whose parent is not labeled yet, like the indices of write_ast(). */
+    int* pending = calloc(nodes->len, sizeof(int));
+    int depth = 0;
+    for (int pos = 0; pos < nodes->len; pos++) {
+        Node* node = nodes->data[pos];
+        State* state = &states[pos];
+        state->node = node;
+        state->rhs = node->rhs ? pending[--depth] : -1;
+        state->lhs = node->lhs ? pending[--depth] : -1;
+        pending[depth++] = pos;
+        state->impure = node->kind == ND_ASSIGN || (state->lhs >= 0 && states[state->lhs].impure) ||
+                        (state->rhs >= 0 && states[state->rhs].impure);
+        for (int nt = 0; nt < NT_COUNT; nt++) {
+            state->cost[nt] = INT_MAX / 2;
+        }
+
+        Vector* matches = rules_of_kind(node->kind);
+        for (int j = 0; j < matches->len; j++) {
+            Rule* rule = matches->data[j];
+            match_rule(states, pos, rule, false);
+            if (rule->commutes) {
+                match_rule(states, pos, rule, true);
+            }
+        }
+        /* Chain rules apply until none makes a nonterminal cheaper. */
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (int j = 0; j < chains->len; j++) {
+                Rule* rule = chains->data[j];
+                int cost = state->cost[rule->leaves[0].nt] + rule->cost;
+                if (cost < state->cost[rule->nt]) {
+                    state->cost[rule->nt] = cost;
+                    state->rule[rule->nt] = rule;
+                    state->swapped[rule->nt] = false;
+                    changed = true;
+                }
+            }
+        }
+
+        bool done[NT_COUNT] = {false};
+        for (int nt = 0; nt < NT_COUNT; nt++) {
+            if (state->rule[nt]) {
+                number_state(states, pos, nt, done);
+            }
+        }
+    }
+
+    Labels* labels = calloc(1, sizeof(Labels));
+    labels->states = states;
+    labels->len = nodes->len;
+    free(pending);
+    free(nodes->data);
+    free(nodes);
+    return labels;
+}
+
+void free_labels(Labels* labels) {
+    free(labels->states);
+    free(labels);
+}
+
+/* Labels the expression of each of the first `len` statements of `code`, once for both
+ * fits_registers() and select_statement(). */
+Vector* label_statements(Vector* code, int len) {
+    Vector* labels = create_vector();
+    for (int i = 0; i < len; i++) {
+        Node* node = code->data[i];
+        vec_push(labels, label_tree(node->kind == ND_RETURN ? node->lhs : node));
+    }
+    return labels;
+}
+
+/* Applies the rule of `frame`, whose leaves are reduced, and returns its operand. */
+char* apply_rule(ExprStack* stack, Reduction* frame) {
+    State* state = &stack->states[frame->node];
+    Rule* rule = state->rule[frame->nt];
+    int held = 0;
+    for (int i = 0; i < leaf_count(rule); i++) {
+        int leaf = follow(stack->states, frame->node, rule->leaves[i].path,
+                          state->swapped[frame->nt]);
+        held += stack->states[leaf].regs[rule->leaves[i].nt];
+    }
+    if (frame->nt != NT_REG && frame->nt != NT_STMT) {
+        /* Operands keep their registers until an instruction takes them. */
+        return rule->emit(state->node, frame->kids, NULL);
+    }
+
+    /* The value goes to the lowest register of the leaves, which are the top of the stack. */
+    char* dst = held > 0 ? expr_reg(stack->depth - held) : NULL;
+    if (frame->nt == NT_REG && held == 0) {
+        dst = push_value(stack);
+    }
+    rule->emit(state->node, frame->kids, dst);
+    int drops = frame->nt == NT_REG && held > 0 ? held - 1 : held;
+    for (int i = 0; i < drops; i++) {
+        pop_value(stack);
+    }
+    return frame->nt == NT_REG ? dst : NULL;
+}
+
+/* Emits the code of the cheapest cover of the tree at `root` as `nt`, from the root down. */
+void reduce_tree(ExprStack* stack, int root, Nonterm nt) {
+    if (!stack->states[root].rule[nt]) {
+        error("no rule reduces node kind %d.", stack->states[root].node->kind);
+    }
+    /* Reductions whose leaves are being reduced are kept on a heap allocated work stack
+     * instead of the C stack, so deep trees cannot overflow it. */
+    int capacity = 16;
+    int len = 0;
+    Reduction* frames = calloc(capacity, sizeof(Reduction));
+    frames[len++] = (Reduction){root, nt, 0, {0}, {NULL}, -1, 0};
+
+    while (len > 0) {
+        Reduction* frame = &frames[len - 1];
+        State* state = &stack->states[frame->node];
+        Rule* rule = state->rule[frame->nt];
+        if (frame->state == 0) {
+            order_leaves(stack->states, frame->node, frame->nt, frame->order);
+        }
+        if (frame->state == leaf_count(rule)) {
+            char* operand = apply_rule(stack, frame);
+            if (frame->parent >= 0) {
+                frames[frame->parent].kids[frame->slot] = operand;
+            }
+            len--;
+            continue;
+        }
+
+        int slot = frame->order[frame->state++];
+        Leaf* leaf = &rule->leaves[slot];
+        int pos = follow(stack->states, frame->node, leaf->path, state->swapped[frame->nt]);
+        if (len == capacity) {
+            capacity *= 2;
+            frames = realloc(frames, sizeof(Reduction) * capacity);
+            if (!frames) {
+                error("out of memory.");
+            }
+        }
+        frames[len] = (Reduction){pos, leaf->nt, 0, {0}, {NULL}, len - 1, slot};
+        len++;
+    }
+
+    free(frames);
+}
+
+/* Prints the code of the statement `node` from the `labels` of its expression, which leaves its
+ * value in rax if `used` is true. */
+void select_statement(Node* node, Labels* labels, bool used) {
+    bool returns = node->kind == ND_RETURN;
+    ExprStack stack = {labels->states, 0};
+    int root = labels->len - 1;
+    if (!used && !returns) {
+        reduce_tree(&stack, root, NT_STMT);
+    } else {
+        reduce_tree(&stack, root, NT_REG);
+        emit("  mov rax, %s\n", expr_reg(0));
+        pop_value(&stack);
+    }
+    if (returns) {
+        generate_return();
+    }
+}
+
+/* Returns the registers that the value of the labeled tree needs at once. */
+int tree_registers(Labels* labels) { return labels->states[labels->len - 1].need[NT_REG]; }
+
+/* Returns true if the statements of the `labels` need no more than the registers of
+ * expressions. */
+bool fits_registers(Vector* labels) {
+    for (int i = 0; i < labels->len; i++) {
+        if (tree_registers(labels->data[i]) > EXPR_REG_COUNT) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef SELECT_H
+#define SELECT_H
+
+#include <stdbool.h>
+
+#include "node.h"
+#include "vector.h"
+
+/* Scratch registers of expressions, see select.c. */
+#define EXPR_REG_COUNT 5
+
+/* Forms that the rules reduce trees to. */
+typedef enum {
+    NT_REG,        // Value in a register.
+    NT_STMT,       // Code run for its effects, whose value is dropped.
+    NT_CONST,      // Any constant.
+    NT_IMM,        // Constant that fits a sign extended 32 bit immediate.
+    NT_ZERO,       // The constant 0.
+    NT_SCALE,      // Constant 1, 2, 4 or 8, the scale of an index.
+    NT_SHIFT,      // Constant 0 to 3, the shift of an index.
+    NT_MEM,        // Local variable in memory.
+    NT_INDEX,      // `reg*scale` of an address.
+    NT_BASE_DISP,  // `reg+disp` of an address.
+    NT_BASE_INDEX, // `reg+reg*scale` of an address.
+    NT_ADDRESS,    // `reg+reg*scale+disp` of an address.
+    NT_COUNT,
+} Nonterm;
+
+/*
+ * Leaf of a pattern, the node at `path` under the root reduced to `nt`. Each letter of the path
+ * takes the lhs (l) or the rhs (r) of a node, and the empty path of a chain rule is the root.
+ */
+typedef struct {
+    char* path;
+    Nonterm nt;
+} Leaf;
+
+/* Checks the values of a match, where `lhs` and `rhs` are the children in pattern order. */
+typedef bool (*RuleAccepts)(Node* node, Node* lhs, Node* rhs);
+
+/*
+ * Emits the code of a rule matched at `node`, whose leaves were reduced to the operands `kids` in
+ * pattern order. Rules to NT_REG compute into the register `dst`, and rules to operands return
+ * the text of the operand.
+ */
+typedef char* (*RuleEmit)(Node* node, char** kids, char* dst);
+
+/* Root of the pattern of a chain rule, which reduces a node from one nonterminal to another. */
+#define CHAIN -1
+
+/* `nt` <- `kind`(leaves), costing `cost` besides the leaves. */
+typedef struct {
+    Nonterm nt;
+    int kind;
+    Leaf leaves[2];
+    int cost;
+    bool commutes; // Also matches with the children of the root swapped.
+    RuleAccepts accepts;
+    RuleEmit emit;
+    bool updates; // Also reads the variable that the assignment writes, after the other leaf.
+} Rule;
+
+/* Cheapest rule reducing a node to each nonterminal, found by label_tree(). */
+typedef struct {
+    Node* node;
+    int lhs;     // Position of the state of the lhs, -1 if none.
+    int rhs;     // Position of the state of the rhs, -1 if none.
+    bool impure; // The subtree contains an assignment, like the `impure` map of simplify().
+    int cost[NT_COUNT];
+    Rule* rule[NT_COUNT];
+    bool swapped[NT_COUNT];
+    int need[NT_COUNT]; // Registers the reduction needs at once.
+    int regs[NT_COUNT]; // Registers its operand holds.
+} State;
+
+/* States of the nodes of a tree, in post order with the root last. */
+typedef struct {
+    State* states;
+    int len;
+} Labels;
+
+/* States of the nodes, and how many values are on the stack of registers. */
+typedef struct {
+    State* states;
+    int depth;
+} ExprStack;
+
+/* Reduction of a node whose leaves are being reduced, see reduce_tree(). */
+typedef struct {
+    int node; // Position of the state of the node.
+    Nonterm nt;
+    int state; // Leaves reduced so far.
+    int order[2];
+    char* kids[2];
+    int parent; // Frame whose leaf this is, or -1.
+    int slot;   // Index of the leaf in the parent.
+} Reduction;
+
+Labels* label_tree(Node* root);
+
+void free_labels(Labels* labels);
+
+Vector* label_statements(Vector* code, int len);
+
+char* expr_reg(int depth);
+
+char* push_value(ExprStack* stack);
+
+void pop_value(ExprStack* stack);
+
+void reduce_tree(ExprStack* stack, int root, Nonterm nt);
+
+void select_statement(Node* node, Labels* labels, bool used);
+
+int tree_registers(Labels* labels);
+
+bool fits_registers(Vector* labels);
+
+#endif // !SELECT_H
@@ -0,0 +1,208 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "map.h"
+#include "node.h"
+#include "serialize.h"
+#include "vector.h"
+
+uint64_t fnv1a(uint64_t hash, void* data, uint64_t size) {
+    unsigned char* p = data;
+    for (uint64_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Writes statements `code` and variables `locals` to an AST file at `path`. */
+void write_ast(char* path, Vector* code, LVar* locals) {
+    Buffer nodes = {0};
+    Buffer statements = {0};
+    Buffer lvars = {0};
+    Buffer names = {0};
+    AstHeader header = {AST_MAGIC, AST_VERSION};
+
+    /* Number variables in `locals` order. */
+    Map* lvar_index = create_map();
+    for (LVar* var = locals; var; var = var->next) {
+        map_put(lvar_index, var, (void*)(intptr_t)header.lvar_count++);
+        AstLVar lvar = {names.len, var->len, var->offset, 0};
+        buf_append(&lvars, &lvar, sizeof(lvar));
+        buf_append(&names, var->name, var->len);
+        buf_append(&names, "", 1);
+    }
+
+    /* Children come first in post order, so their indices are on top of `indices`. */
+    Vector* indices = create_vector();
+    for (int i = 0; i < code->len; i++) {
+        Vector* postorder = postorder_nodes(code->data[i]);
+        for (int j = 0; j < postorder->len; j++) {
+            Node* node = postorder->data[j];
+            AstNode entry = {node->kind, -1, -1, -1, node->val};
+            if (node->rhs) {
+                entry.rhs = (intptr_t)vec_pop(indices);
+            }
+            if (node->lhs) {
+                entry.lhs = (intptr_t)vec_pop(indices);
+            }
+            if (node->kind == ND_LVAR) {
+                entry.lvar = (intptr_t)map_get(lvar_index, node->lvar);
+            }
+            vec_push(indices, (void*)(intptr_t)header.node_count);
+            buf_append(&nodes, &entry, sizeof(entry));
+            header.node_count++;
+        }
+        uint32_t root = (intptr_t)vec_pop(indices);
+        buf_append(&statements, &root, sizeof(root));
+        header.statement_count++;
+    }
+    /* Keep every section 8 byte aligned for the mapped AstNode and AstLVar. */
+    if (statements.len % 8) {
+        buf_append(&statements, &(uint32_t){0}, sizeof(uint32_t));
+    }
+    header.names_size = names.len;
+
+    Buffer* sections[] = {&nodes, &statements, &lvars, &names};
+    header.checksum = 14695981039346656037ull;
+    for (int i = 0; i < 4; i++) {
+        header.checksum = fnv1a(header.checksum, sections[i]->data, sections[i]->len);
+    }
+
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        error("cannot open %s.", path);
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    for (int i = 0; i < 4; i++) {
+        fwrite(sections[i]->data, 1, sections[i]->len, out);
+    }
+    if (fclose(out) != 0) {
+        error("cannot write %s.", path);
+    }
+}
+
+/* Maps an AST file at `path` to memory after checking its header and checksum. */
+AstFile* map_ast(char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error("cannot open %s.", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(AstHeader)) {
+        error("%s is not an AST file.", path);
+    }
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error("cannot map %s.", path);
+    }
+
+    AstFile* file = calloc(1, sizeof(AstFile));
+    file->header = (AstHeader*)data;
+    file->size = st.st_size;
+    if (memcmp(file->header->magic, AST_MAGIC, sizeof(file->header->magic)) != 0) {
+        error("%s is not an AST file.", path);
+    }
+    if (file->header->version != AST_VERSION) {
+        error("%s has AST version %u, expected %u.", path, file->header->version, AST_VERSION);
+    }
+
+    uint64_t statements_size = file->header->statement_count * sizeof(uint32_t);
+    statements_size = (statements_size + 7) & ~7ull;
+    uint64_t size = sizeof(AstHeader) + file->header->node_count * sizeof(AstNode) +
+                    statements_size + file->header->lvar_count * sizeof(AstLVar) +
+                    file->header->names_size;
+    if (size != file->size) {
+        error("%s is truncated.", path);
+    }
+    uint64_t checksum = fnv1a(14695981039346656037ull, data + sizeof(AstHeader),
+                              file->size - sizeof(AstHeader));
+    if (checksum != file->header->checksum) {
+        error("%s is corrupted, checksum mismatch.", path);
+    }
+
+    file->nodes = (AstNode*)(data + sizeof(AstHeader));
+    file->statements = (uint32_t*)(file->nodes + file->header->node_count);
+    file->lvars = (AstLVar*)((char*)file->statements + statements_size);
+    file->names = (char*)(file->lvars + file->header->lvar_count);
+    return file;
+}
+
+/* Marks node `index` of `file`, if any, as used by a parent or by a statement if `statement` is
+ * true. Returns false if it is already used, or is an ND_RETURN that is not a statement. */
+bool claim_node(AstFile* file, bool* used, int32_t index, bool statement) {
+    if (index < 0) {
+        return true;
+    }
+    if (used[index] || (!statement && file->nodes[index].kind == ND_RETURN)) {
+        return false;
+    }
+    used[index] = true;
+    return true;
+}
+
+/*
+ * Builds the statements of a mapped AST file, linking its variables to `locals`. The nodes are
+ * copied, and must form trees as program() makes them: every node has one parent or is one
+ * statement, ND_RETURN is only a statement, and ND_ASSIGN stores to an ND_LVAR.
+ */
+Vector* ast_to_nodes(AstFile* file) {
+    AstHeader* header = file->header;
+    LVar* lvars = calloc(header->lvar_count, sizeof(LVar));
+    for (int i = header->lvar_count - 1; i >= 0; i--) {
+        /* Offsets are positive multiples of 8, as assign_lvar_offsets() gives. */
+        if (file->lvars[i].len < 0 ||
+            (uint64_t)file->lvars[i].name + file->lvars[i].len >= header->names_size ||
+            file->lvars[i].offset <= 0 || file->lvars[i].offset % 8 != 0) {
+            error("AST variable %d is malformed.", i);
+        }
+        lvars[i].name = file->names + file->lvars[i].name;
+        lvars[i].len = file->lvars[i].len;
+        lvars[i].offset = file->lvars[i].offset;
+        lvars[i].next = locals;
+        locals = &lvars[i];
+    }
+
+    /* Children are stored before their parent, so one pass in file order links them. */
+    Node* nodes = calloc(header->node_count, sizeof(Node));
+    bool* used = calloc(header->node_count, sizeof(bool));
+    for (int i = 0; i < header->node_count; i++) {
+        AstNode* entry = &file->nodes[i];
+        /* ND_NUM and ND_LVAR are leaves, ND_RETURN has lhs only, the others have both. */
+        bool leaf = entry->kind == ND_NUM || entry->kind == ND_LVAR;
+        bool binary = !leaf && entry->kind != ND_RETURN;
+        if (entry->kind > ND_NUM || entry->lhs >= i || entry->rhs >= i ||
+            (entry->lhs >= 0) == leaf || (entry->rhs >= 0) != binary ||
+            entry->lvar >= (int32_t)header->lvar_count ||
+            (entry->lvar >= 0) != (entry->kind == ND_LVAR) ||
+            (entry->kind == ND_ASSIGN && file->nodes[entry->lhs].kind != ND_LVAR) ||
+            !claim_node(file, used, entry->lhs, false) || !claim_node(file, used, entry->rhs, false)) {
+            error("AST node %d is malformed.", i);
+        }
+        nodes[i].kind = entry->kind;
+        nodes[i].lhs = entry->lhs >= 0 ? &nodes[entry->lhs] : NULL;
+        nodes[i].rhs = entry->rhs >= 0 ? &nodes[entry->rhs] : NULL;
+        nodes[i].lvar = entry->lvar >= 0 ? &lvars[entry->lvar] : NULL;
+        nodes[i].val = entry->val;
+    }
+
+    Vector* code = create_vector();
+    for (int i = 0; i < header->statement_count; i++) {
+        if (file->statements[i] >= header->node_count ||
+            !claim_node(file, used, file->statements[i], true)) {
+            error("AST statement %d is malformed.", i);
+        }
+        vec_push(code, &nodes[file->statements[i]]);
+    }
+    free(used);
+    return code;
+}
@@ -0,0 +1,68 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stdint.h>
+
+#include "node.h"
+#include "vector.h"
+
+#define AST_MAGIC "9CCAST\0"
+#define AST_VERSION 2
+
+/*
+ * Binary AST file, laid out as
+ *
+ *   AstHeader
+ *   AstNode nodes[node_count]          children before their parent
+ *   uint32_t statements[statement_count] root node index of each statement
+ *   AstLVar lvars[lvar_count]
+ *   char names[names_size]             variable names, NUL terminated
+ *
+ * Every reference is an index or an offset, so the file is checked in place after mmap, and
+ * ast_to_nodes() links a copy of its nodes.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t statement_count;
+    uint32_t lvar_count;
+    uint32_t names_size;
+    uint32_t reserved;
+    uint64_t checksum; // FNV-1a of everything after the header.
+} AstHeader;
+
+typedef struct {
+    uint32_t kind; // NodeKind.
+    int32_t lhs;   // Node index, -1 if none.
+    int32_t rhs;   // Node index, -1 if none.
+    int32_t lvar;  // LVar index when kind is ND_LVAR, -1 otherwise.
+    int64_t val;   // Value when kind is ND_NUM.
+} AstNode;
+
+typedef struct {
+    uint32_t name; // Offset in names.
+    int32_t len;
+    int32_t offset;
+    uint32_t reserved;
+} AstLVar;
+
+/* AST file mapped to memory. */
+typedef struct {
+    AstHeader* header;
+    AstNode* nodes;
+    uint32_t* statements;
+    AstLVar* lvars;
+    char* names;
+    uint64_t size;
+} AstFile;
+
+uint64_t fnv1a(uint64_t hash, void* data, uint64_t size);
+
+void write_ast(char* path, Vector* code, LVar* locals);
+
+AstFile* map_ast(char* path);
+
+Vector* ast_to_nodes(AstFile* file);
+
+#endif // !SERIALIZE_H
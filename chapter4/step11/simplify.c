@@ -0,0 +1,174 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "fold.h"
+#include "map.h"
+#include "node.h"
+#include "simplify.h"
+#include "vector.h"
+
+/*
+ * Algebraic simplification.
+ *
+ * Nodes are rewritten in post order with these identities, where `c` is an ND_NUM:
+ *
+ *   c + x, c * x, c == x, c != x  =>  operands swapped, so constants are on the right
+ *   x + 0, x - 0, x * 1, x / 1    =>  x
+ *   x * 0                         =>  0           if x has no effect
+ *   x * -1                        =>  0 - x
+ *   x * 2^k                       =>  x << k
+ *   x - x, x != x, x < x          =>  0           if x has no effect
+ *   x == x, x <= x                =>  1           if x has no effect
+ *
+ * Effects are assignments and divisions that may trap, which must still happen.
+ *
+ * Multiplication by 3, 5 and 9 and division by powers of two are left to codegen, which has
+ * `lea` and shift sequences for them.
+ */
+
+bool is_num(Node* node, long val) { return node->kind == ND_NUM && node->val == val; }
+
+/* Return true if `node` itself assigns, or divides and may trap at runtime. */
+bool has_effect(Node* node) {
+    if (node->kind == ND_ASSIGN) {
+        return true;
+    }
+    return node->kind == ND_DIV && (node->rhs->kind != ND_NUM || is_num(node->rhs, 0) ||
+                                    is_num(node->rhs, -1));
+}
+
+/* Returns k if `val` is 2^k with k >= 1, or 0 otherwise. */
+int log2_exact(unsigned long val) {
+    if (val < 2 || (val & (val - 1))) {
+        return 0;
+    }
+    int k = 0;
+    while (val >>= 1) {
+        k++;
+    }
+    return k;
+}
+
+/* Returns true if the trees `a` and `b` have the same shape, operators, values and variables. */
+bool same_tree(Node* a, Node* b) {
+    Vector* stack = create_vector();
+    vec_push(stack, a);
+    vec_push(stack, b);
+    bool same = true;
+    while (same && stack->len > 0) {
+        Node* y = vec_pop(stack);
+        Node* x = vec_pop(stack);
+        if (!x || !y) {
+            same = x == y;
+            continue;
+        }
+        same = x->kind == y->kind && x->val == y->val && x->lvar == y->lvar;
+        vec_push(stack, x->lhs);
+        vec_push(stack, y->lhs);
+        vec_push(stack, x->rhs);
+        vec_push(stack, y->rhs);
+    }
+    free(stack->data);
+    free(stack);
+    return same;
+}
+
+/* Makes `node` a copy of `from`. */
+void replace_node(Node* node, Node* from) { *node = *from; }
+
+void replace_num(Node* node, long val) {
+    node->kind = ND_NUM;
+    node->val = val;
+    node->lhs = NULL;
+    node->rhs = NULL;
+}
+
+/* Applies the identities to `node`, whose children are already simplified. */
+/* `impure` holds the nodes that contain an effect. */
+void simplify_node(Node* node, Map* impure) {
+    if (fold_node(node) || !node->lhs || !node->rhs || node->kind == ND_ASSIGN) {
+        return;
+    }
+
+    Node* lhs = node->lhs;
+    Node* rhs = node->rhs;
+    bool commutative = node->kind == ND_ADD || node->kind == ND_MUL || node->kind == ND_EQ ||
+                       node->kind == ND_NEQ;
+    /* A constant has no effect, so evaluating it second changes nothing. */
+    if (commutative && lhs->kind == ND_NUM && rhs->kind != ND_NUM) {
+        node->lhs = rhs;
+        node->rhs = lhs;
+        lhs = node->lhs;
+        rhs = node->rhs;
+    }
+    bool pure = !map_contains(impure, lhs);
+
+    switch (node->kind) {
+    case ND_ADD:
+    case ND_SUB:
+        if (is_num(rhs, 0)) {
+            replace_node(node, lhs);
+            return;
+        }
+        if (node->kind == ND_SUB && pure && same_tree(lhs, rhs)) {
+            replace_num(node, 0);
+        }
+        return;
+    case ND_MUL:
+        if (is_num(rhs, 1)) {
+            replace_node(node, lhs);
+            return;
+        }
+        if (is_num(rhs, 0) && pure) {
+            replace_num(node, 0);
+            return;
+        }
+        if (is_num(rhs, -1)) {
+            node->kind = ND_SUB;
+            node->lhs = create_node_num(0);
+            node->rhs = lhs;
+            return;
+        }
+        if (rhs->kind == ND_NUM && log2_exact(rhs->val)) {
+            node->kind = ND_SHL;
+            node->rhs = create_node_num(log2_exact(rhs->val));
+        }
+        return;
+    case ND_DIV:
+        if (is_num(rhs, 1)) {
+            replace_node(node, lhs);
+        }
+        return;
+    case ND_EQ:
+    case ND_LTE:
+        if (pure && same_tree(lhs, rhs)) {
+            replace_num(node, 1);
+        }
+        return;
+    case ND_NEQ:
+    case ND_LT:
+        if (pure && same_tree(lhs, rhs)) {
+            replace_num(node, 0);
+        }
+        return;
+    default:
+        return;
+    }
+}
+
+void simplify(Vector* code) {
+    for (int i = 0; i < code->len; i++) {
+        Vector* nodes = postorder_nodes(code->data[i]);
+        Map* impure = create_map();
+        for (int j = 0; j < nodes->len; j++) {
+            Node* node = nodes->data[j];
+            simplify_node(node, impure);
+            if (has_effect(node) || (node->lhs && map_contains(impure, node->lhs)) ||
+                (node->rhs && map_contains(impure, node->rhs))) {
+                map_put(impure, node, node);
+            }
+        }
+        free(nodes->data);
+        free(nodes);
+    }
+}
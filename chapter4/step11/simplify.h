@@ -0,0 +1,9 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "node.h"
+#include "vector.h"
+
+void simplify(Vector* code);
+
+#endif // !SIMPLIFY_H
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ir.h"
+#include "map.h"
+#include "ssa.h"
+#include "vector.h"
+
+/*
+ * SSA construction.
+ *
+ * Virtual registers are already assigned once each, so only local variables need renaming.
+ * Every load of a variable is replaced by the register last stored to it, found by the
+ * algorithm of Braun et al., "Simple and Efficient Construction of Static Single Assignment
+ * Form": the definition in the same block, else the one at the end of the single predecessor,
+ * else a phi of the definitions at the end of every predecessor.
+ *
+ * Blocks are visited in order, and every block comes after its predecessors, so the definitions
+ * at the end of the predecessors are always complete. Loops will need the incomplete phis of the
+ * paper. A load that may read a variable never stored is kept, and reads the memory.
+ *
+ * Stores are kept, and are dead once no load remains.
+ */
+
+/* Register `reg` renamed by the removed loads. */
+int resolve(Map* renames, int reg) {
+    while (map_contains(renames, (void*)(long)reg)) {
+        reg = (int)(long)map_get(renames, (void*)(long)reg);
+    }
+    return reg;
+}
+
+void write_variable(Map** defs, Block* block, LVar* lvar, int reg) {
+    map_put(defs[block->id], lvar, (void*)(long)reg);
+}
+
+/* Returns the register holding `lvar` at the current end of `block`, 0 if it may be unset. */
+/* New phis are added to `phis` of their block. */
+int read_variable(IrProgram* prog, Map** defs, Vector** phis, Block* block, LVar* lvar) {
+    Block* from = block;
+    while (!map_contains(defs[from->id], lvar) && from->preds->len == 1) {
+        from = from->preds->data[0];
+    }
+    if (map_contains(defs[from->id], lvar)) {
+        int reg = (int)(long)map_get(defs[from->id], lvar);
+        write_variable(defs, block, lvar, reg);
+        return reg;
+    }
+    if (from->preds->len == 0) {
+        return 0;
+    }
+
+    Vector* args = create_vector();
+    bool same = true;
+    for (int i = 0; i < from->preds->len; i++) {
+        int reg = read_variable(prog, defs, phis, from->preds->data[i], lvar);
+        if (!reg) {
+            return 0;
+        }
+        same = same && (i == 0 || reg == (int)(long)args->data[0]);
+        vec_push(args, (void*)(long)reg);
+    }
+    /* A phi of one register is that register. */
+    int reg = (int)(long)args->data[0];
+    if (!same) {
+        Ir* phi = calloc(1, sizeof(Ir));
+        phi->kind = IR_PHI;
+        phi->dst = reg = new_reg(prog);
+        phi->args = args;
+        vec_push(phis[from->id], phi);
+    }
+    write_variable(defs, from, lvar, reg);
+    write_variable(defs, block, lvar, reg);
+    return reg;
+}
+
+void build_ssa(IrProgram* prog) {
+    Map** defs = calloc(prog->blocks->len, sizeof(Map*));
+    Vector** phis = calloc(prog->blocks->len, sizeof(Vector*));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        defs[i] = create_map();
+        phis[i] = create_vector();
+    }
+    Map* renames = create_map();
+
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        /* Instructions are compacted in place as loads are removed. */
+        int len = 0;
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            ir->lhs = resolve(renames, ir->lhs);
+            ir->rhs = resolve(renames, ir->rhs);
+            if (ir->kind == IR_LOAD) {
+                int reg = read_variable(prog, defs, phis, block, ir->lvar);
+                if (reg) {
+                    map_put(renames, (void*)(long)ir->dst, (void*)(long)reg);
+                    continue;
+                }
+                write_variable(defs, block, ir->lvar, ir->dst);
+            }
+            if (ir->kind == IR_STORE) {
+                write_variable(defs, block, ir->lvar, ir->lhs);
+            }
+            block->irs->data[len++] = ir;
+        }
+        block->irs->len = len;
+    }
+
+    /* Phis run on entry, before any instruction of the block. */
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            vec_push(phis[i], block->irs->data[j]);
+        }
+        block->irs = phis[i];
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include "ir.h"
+
+void build_ssa(IrProgram* prog);
+
+#endif // !SSA_H
@@ -2,20 +2,38 @@
 
 # if want to debug, run `bash -x test.sh`
 
+# Optimization levels every program is compiled with, with commas between options. Constant
+# propagation folds whole programs, so the backend is also tested without it.
+opt_levels="-O0 -O0,-fstack-machine -O1 -O1,-fno-const-prop -O1,-feval -O2,-fno-const-prop"
+
+# Programs run as static executables written by 9cc itself, with no assembler or linker, in the
+# process of 9cc by `--run`, and on the bytecode interpreter by both dispatches.
 assert() {
     input="$1"
     expected="$2"
 
-    ./9cc "$input" > temp.s
-    cc -o temp temp.s
-    ./temp
-    actual="$?"
+    for opt in $opt_levels; do
+        ./9cc ${opt//,/ } --exe -o temp "$input"
+        ./temp
+        actual="$?"
+        ./9cc ${opt//,/ } --run "$input"
+        run="$?"
+        ./9cc ${opt//,/ } --interp "$input"
+        interp="$?"
 
-    if [ "$actual" = "$expected" ]; then
-        echo "$input => $actual"
-    else
-    	echo "$input => $expected expected, but got $actual"
-	exit 1
+        if [ "$actual $run $interp" = "$expected $expected $expected" ]; then
+            echo "$opt $input => $actual"
+        else
+            echo "$opt $input => $expected expected, but got $actual, $run by --run and" \
+                "$interp by --interp"
+            exit 1
+        fi
+    done
+    ./9cc --interp=switch "$input"
+    actual="$?"
+    if [ "$actual" != "$expected" ]; then
+        echo "--interp=switch $input => $expected expected, but got $actual"
+        exit 1
     fi
 }
 
@@ -52,4 +70,839 @@ assert "abc=10; edf=5; (abc+5)*edf;" 75
 assert "return 5;" 5
 assert "abc=10; abc=abc+5; return abc; " 15
 
+# 64 bit arithmetic, wrapping around like the hardware.
+assert "return 2147483647+1 == 2147483648;" 1
+assert "return 4000000000*4000000000 == 0-2446744073709551616;" 1
+assert "return 9223372036854775807+1 < 0;" 1
+assert "a=5; return a*(9-6)-a;" 10
+
+# Constant subtrees are folded away.
+assert_folded() {
+    input="$1"
+
+    ./9cc "$input" > temp.s
+    if grep -qE "add|sub rax|imul|idiv|cmp" temp.s; then
+        echo "$input => folded code expected, but got"
+        cat temp.s
+        exit 1
+    fi
+    echo "$input => folded"
+}
+
+assert_folded "5*(9-6);"
+assert_folded "return -2 + 6 * (3 < 4) - 10/3;"
+assert_folded "return (1+1)*2 >= 4;"
+
+# Division by a constant zero is left for runtime.
+./9cc "return 1/0;" > temp.s
+if ! grep -q idiv temp.s; then
+    echo "return 1/0; => idiv expected"
+    exit 1
+fi
+echo "return 1/0; => left for runtime"
+
+# Algebraic identities and strength reduction.
+assert "a=7; return a*0+a*1+a-a+(a==a)+(a<=a)+(a!=a)+(a<a);" 9
+assert "a=1; b=(a=5)*0; return a;" 5
+assert "a=0-7; return a*(0-1) == 7;" 1
+assert "a=0-7; return a*8 == 0-56;" 1
+assert "a=6; return a*3+a*5+a*9;" 102
+assert "a=0-7; return a/2 == 0-3;" 1
+assert "a=0-9; return a/(0-8) == 1;" 1
+assert "a=9; return a/4+a/(0-4);" 0
+assert "a=1; b=0; return (a/b)*0;" 136
+
+./9cc -fno-const-prop "a=6; return a*9+a*8+a/4;" > temp.s
+if ! grep -q lea temp.s || ! grep -q "shl rax, 3" temp.s || ! grep -q "sar rax, 2" temp.s ||
+    grep -qE "imul|idiv" temp.s; then
+    echo "a*9+a*8+a/4 => lea, shl and sar expected, but got"
+    cat temp.s
+    exit 1
+fi
+echo "a*9+a*8+a/4 => lea, shl and sar"
+
+# Division by constants, checked against the `idiv` of the shell's own arithmetic.
+# Reads "dividend divisor" pairs and compiles them into one program that counts wrong quotients.
+assert_division() {
+    name="$1"
+
+    while read -r n d; do
+        echo "a=($n); r=r+(a/($d) != ($((n / d))));"
+    done | sed 's/(-9223372036854775808)/(-9223372036854775807-1)/g' > temp.in
+    echo "return r != 0;" >> temp.in
+
+    ./9cc -O1 -fno-const-prop - < temp.in > temp.s || exit 1
+    if grep -q idiv temp.s; then
+        echo "$name => no idiv expected"
+        exit 1
+    fi
+    ./9cc -O1 -fno-const-prop --exe -o temp - < temp.in || exit 1
+    ./temp
+    actual="$?"
+
+    if [ "$actual" = 0 ]; then
+        echo "$name => $(wc -l < temp.in) quotients"
+    else
+        echo "$name => a wrong quotient"
+        exit 1
+    fi
+}
+
+min=-9223372036854775808
+max=9223372036854775807
+for d in $(seq -1000 1000); do
+    [ "${d#-}" -le 1 ] && continue
+    for n in 0 1 -1 $((d - 1)) $d $((d + 1)) $((-d + 1)) $((-d)) $((-d - 1)) \
+        $max $((max - 1)) $((max - max % d)) $min $((min + 1)) $((min - min % d)); do
+        echo "$n $d"
+    done
+done | assert_division "every divisor in [-1000, 1000]"
+
+# Sets `value` to a random magnitude in [0, 2^bits) with a random sign, so small values are
+# common too. Subshells reseed RANDOM, so this sets a variable instead of printing.
+random64() {
+    bits=$((RANDOM % 63 + 1))
+    value=$(((RANDOM << 48 ^ RANDOM << 33 ^ RANDOM << 18 ^ RANDOM << 3 ^ RANDOM) & ((1 << bits) - 1)))
+    [ $((RANDOM % 2)) = 0 ] && value=$((-value))
+}
+
+{
+    RANDOM=33
+    for i in $(seq 3000); do
+        random64
+        d=$value
+        random64
+        [ "${d#-}" -le 1 ] || echo "$value $d"
+    done
+} | assert_division "random divisors"
+
+# The IR is printed by `--emit-ir`, one instruction per line.
+assert_ir() {
+    input="$1"
+    expected="$2"
+    shift 2
+
+    actual=$(./9cc --emit-ir "$@" "$input" | tr '\n' ';' | sed 's/  //g')
+
+    if [ "$actual" = "$expected" ]; then
+        echo "$input => $actual"
+    else
+        echo "$input => $expected expected, but got $actual"
+        exit 1
+    fi
+}
+
+assert_ir "a=2; return a*3+1;" "b0:;v1 = 2;store a, v1;v2 = load a;v3 = 3;v4 = mul v2, v3;v5 = 1;v6 = add v4, v5;ret v6;" -O0
+assert_ir "return 2*(1+2);" "b0:;v1 = 2;v2 = 1;v3 = 2;v4 = add v2, v3;v5 = mul v1, v4;ret v5;" -O0
+assert_ir "return 2*(1+2);" "b0:;v1 = 6;ret v1;"
+assert_ir "a=b=1;" "b0:;v1 = 1;store b, v1;store a, v1;ret v1;" -O0
+assert_ir "return 1; 2;" "b0:;v1 = 1;ret v1;b1:;v2 = 2;ret v2;" -O0
+
+# Loads of stored variables are replaced by the stored register, then constants propagate and
+# unused values and stores are removed.
+assert_ir "a=2; return a*3+1;" "b0:;v6 = 7;ret v6;"
+assert_ir "a=3; b=a*2; return b+1;" "b0:;v1 = 3;v3 = 1;v4 = shl v1, v3;v7 = add v4, v3;ret v7;" -fno-const-prop
+assert_ir "a=3; b=a*2; return b+1;" "b0:;v7 = 7;ret v7;"
+assert_ir "b=a; a=1; return a+b;" "b0:;v1 = load a;v2 = 1;v5 = add v1, v2;ret v5;"
+assert_ir "a=0; return 1/a;" "b0:;v1 = 0;v2 = 1;v4 = div v2, v1;ret v4;"
+
+# Values computed again are reused, until an assignment changes an operand.
+assert_ir "return (a+b)*(b+a);" "b0:;v1 = load a;v2 = load b;v3 = add v1, v2;v7 = mul v3, v3;ret v7;"
+assert_ir "c=a*b; d=b*a; return c-d+(c<=d);" "b0:;v13 = 1;ret v13;"
+assert_ir "c=a*b; a=4; return c+a*b;" "b0:;v1 = load a;v2 = load b;v3 = mul v1, v2;v4 = 4;v8 = mul v2, v4;v9 = add v3, v8;ret v9;"
+assert "a=2; b=3; c=(a+b)*(b+a); a=4; return c+(a+b)*(b+a);" 74
+
+# Dead stores, unused values and statements after `return` are eliminated, and counted.
+assert_ir "a=1; a+2; b=a*3; return 5; c=7;" "b0:;v8 = 5;ret v8;" -fno-const-prop
+assert_ir "a=1; b=2; a=b; return a;" "b0:;v2 = 2;ret v2;" -fno-const-prop
+assert_ir "a=0; b=1/a; c=2/7; return 2;" "b0:;v1 = 0;v2 = 1;v4 = div v2, v1;v6 = 2;ret v6;" -fno-const-prop
+assert "a=0; b=1/a; return 2;" 136
+assert "return 3; 1/0;" 3
+
+./9cc --stats -fno-const-prop "a=1; a+2; b=a*3; return 5; c=7;" > /dev/null 2> temp.err
+actual=$(grep "^dce:" temp.err)
+if [ "$actual" != "dce: eliminated 10 instructions" ]; then
+    echo "--stats => dce: eliminated 10 instructions expected, but got $actual"
+    exit 1
+fi
+echo "--stats => $actual"
+
+# Whole programs are evaluated at compile time by `-feval`, unless they trap or run out of fuel.
+assert_evaluated() {
+    input="$1"
+    expected="$2"
+    shift 2
+
+    ./9cc "$@" --stats "$input" > temp.s 2> temp.err
+    actual=$(grep "^eval:" temp.err)
+
+    if [ "$actual" = "$expected" ]; then
+        echo "$input => $actual"
+    else
+        echo "$input => $expected expected, but got $actual"
+        exit 1
+    fi
+}
+
+assert_evaluated "a=3; b=a*2; return b+1; c=1/0;" "eval: returns 7" -feval
+assert_evaluated "a=3; a=a*a; a=a*a; a=a*a;" "eval: returns 6561" -feval
+assert_evaluated "a=0; return 1/a;" "eval: gave up" -feval
+assert_evaluated "return b;" "eval: gave up" -feval
+assert_evaluated "a=3; b=a*2; return b+1;" "eval: gave up" -feval-fuel=11
+assert_evaluated "a=3; b=a*2; return b+1;" "eval: returns 7" -feval-fuel=12
+if [ "$(./9cc -feval "a=2; return a*a;" | tail -n 2 | tr '\n' ';')" != "  mov rax, 4;  ret;" ]; then
+    echo "-feval => mov rax, 4; ret expected"
+    exit 1
+fi
+echo "-feval => mov rax, 4; ret"
+
+# Values live in rbx and r12-r15, and go to the stack only when more are live at once.
+assert_spilled() {
+    input="$1"
+    expected="$2"
+    shift 2
+    name="${*:+$* }$input"
+
+    ./9cc -fno-const-prop --stats "$@" "$input" > temp.s 2> temp.err
+    actual=$(grep "^regalloc:" temp.err | cut -d " " -f 3)
+    memory=$(grep -c "\[r[bs]p-" temp.s)
+    saved=$(grep -cE "mov \[r[bs]p-[0-9]+\], (rbx|r1[2-5])$" temp.s)
+
+    # Without spills, the stack holds only the saved registers.
+    if [ "$actual" = "$expected" ] && { [ "$expected" != 0 ] || [ "$memory" = $((saved * 2)) ]; }
+    then
+        echo "$name => $actual spilled"
+    else
+        echo "$name => $expected spilled and only callee-saved accesses expected, but got $actual"
+        cat temp.s
+        exit 1
+    fi
+}
+
+assert_spilled "a=2; b=3; c=a*b+a; d=c-b; return a+b+c+d;" 0
+assert_spilled "a=1; b=2; c=3; return a*b+c*(a+b)-c;" 0
+assert_spilled "a=1; b=2; c=3; d=4; e=5; f=6; g=7; return a*b+c*d+e*f+(f-a)+(g-b);" 1
+assert_spilled "a=2; b=3; c=a*b+a; d=c-b; return a+b+c+d;" 0 -O2
+assert_spilled "a=1; b=2; c=3; return a*b+c*(a+b)-c;" 0 -O2
+assert_spilled "a=1; b=2; c=3; d=4; e=5; f=6; g=7; return a*b+c*d+e*f+(f-a)+(g-b);" 1 -O2
+# Constants only used as immediates and values only returned are given no place, so the six
+# variables, half of them factors of `imul`, fit in the registers.
+assert_spilled "a=1; b=2; c=3; d=4; e=5; f=6; return a*b+c*d+e*f;" 0
+assert_spilled "a=1; b=2; c=3; d=4; e=5; f=6; return a*b+c*d+e*f;" 0 -O2
+
+# -O2 coalesces the result of `add`, `sub` and `imul` with their left operand to skip rax.
+./9cc -O2 -fno-const-prop "a=1; b=2; c=3; return a*b+c*(a-b)-c;" > temp.s
+if ! grep -qE "^  (add|sub|imul) (rbx|r1[2-5]), (rbx|r1[2-5])$" temp.s; then
+    echo "-O2 => in place arithmetic expected"
+    cat temp.s
+    exit 1
+fi
+echo "-O2 => in place arithmetic"
+
+# Values only returned are computed in rax and take no callee-saved register, and the epilogue is
+# labeled only when a return jumps to it.
+for opt in -O1 -O2; do
+    if [ "$(./9cc $opt "a=3; b=a*2; return b+1;" | tail -n 2 | tr '\n' ';')" != "  mov rax, 7;  ret;" ]
+    then
+        echo "$opt => mov rax, 7; ret expected"
+        exit 1
+    fi
+    ./9cc $opt -fno-const-prop "a=3; b=a*2; return b+1;" > temp.s
+    if grep -qE "r1[2-5]|\.L\.return" temp.s; then
+        echo "$opt -fno-const-prop => only rbx and no return label expected"
+        cat temp.s
+        exit 1
+    fi
+    echo "$opt => mov rax, 7; ret"
+done
+assert "a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8; return (a+b+c+d+e+f+g+h) - (a*b*c*d*e*f*g*h)/1000 + h*g*f*e*d*c*b*a/(0-1000);" 212
+
+# -O0 keeps values in registers, ordered by Sethi-Ullman numbers, and pushes them only when a
+# tree needs more than five at once, like this balanced one of depth 6 whose variables are read
+# from memory by their operators.
+assert_pushes() {
+    input="$1"
+    expected="$2"
+
+    ./9cc -O0 "$input" > temp.s
+    # `push rbp` of the prologue is not counted.
+    actual=$(grep "push" temp.s | grep -vc "push rbp")
+
+    if [ "$actual" = "$expected" ]; then
+        echo "$input => $actual pushes"
+    else
+        echo "$input => $expected pushes expected, but got $actual"
+        cat temp.s
+        exit 1
+    fi
+}
+
+assert_pushes "a=1; b=2; c=3; return (a+b)*(b-c)/(a-c*b);" 0
+assert_pushes "a=a=a=a=1; return a;" 0
+balanced="a=1; b=2; c=3; d=4; e=5; f=6; g=7; return ((((((a-b)*(c+d))*((e-f)+(g-a)))*(((b-c)+(d-e))+((f*g)-(a-b))))*((((c-d)+(e-f))+((g*a)-(b-c)))+(((d*e)-(f-g))-((a+b)-(c*d)))))*(((((e-f)+(g-a))+((b*c)-(d-e)))+(((f*g)-(a-b))-((c+d)-(e*f))))+((((g*a)-(b-c))-((d+e)-(f*g)))-(((a+b)-(c*d))-((e-f)*(g+a))))));"
+assert "$balanced" 96
+assert_pushes "$balanced" 1
+# Operands with an assignment are evaluated left to right, even when the right one needs more
+# registers.
+assert "a=1; return a*((a=5)+1);" 6
+assert "a=1; b=2; return a+(a=b*3)*(b+1);" 19
+assert "a=1; b=2; c=3; return a-(a=b*c+b*(c+a))*(b+1);" 215
+
+# Constants and variables are operands of the instructions, and constants are stored directly.
+assert_folds() {
+    options="$1"
+    input="$2"
+    expected="$3"
+
+    ./9cc $options "$input" > temp.s
+    if ! grep -qxF "  $expected" temp.s; then
+        echo "$options $input => \"$expected\" expected"
+        cat temp.s
+        exit 1
+    fi
+    echo "$options $input => $expected"
+}
+
+folded="a=3; b=a*7; c=a+5; return (b<c+20)+(b-a==c);"
+assert "$folded" 1
+assert_folds -O0 "$folded" "mov qword ptr [rsp-24], 3"
+assert_folds -O0 "$folded" "imul rsi, qword ptr [rsp-24], 7"
+assert_folds -O0 "$folded" "add rsi, 5"
+assert_folds -O0 "$folded" "sub r8, qword ptr [rsp-24]"
+assert_folds -O0 "$folded" "cmp r8, qword ptr [rsp-8]"
+assert_folds "-O0 -fstack-machine" "$folded" "mov qword ptr [rbp-24], 3"
+assert_folds "-O0 -fstack-machine" "$folded" "add rax, 5"
+assert_folds "-O1 -fno-const-prop" "$folded" "sub rax, 3"
+
+# -O0 selects the cheapest cover of each tree by the rules of select.c: an address computation is
+# one `lea`, comparisons with 0 `test`, negations `neg`, and updates of variables in memory one
+# instruction.
+assert "a=1; b=2; return a+b*4+8;" 17
+assert_folds -O0 "a=1; b=2; return a+b*4+8;" "lea rsi, [rsi+r8*4+8]"
+assert "a=7; b=2; return b*8+a-3;" 20
+assert_folds -O0 "a=7; b=2; return b*8+a-3;" "lea rsi, [rsi+r8*8-3]"
+assert "a=3; return 0-a;" 253
+assert_folds -O0 "a=3; return 0-a;" "neg rsi"
+assert "a=0-3; return (a<0)+(0<a)*2+(0<=a)*4+(a==0)*8;" 1
+assert_folds -O0 "a=0-3; return (a<0)+(0<a)*2+(0<=a)*4+(a==0)*8;" "test rsi, rsi"
+assert_folds -O0 "a=0-3; return (a<0)+(0<a)*2+(0<=a)*4+(a==0)*8;" "setg al"
+assert "a=1; b=4; a=a+5; b=b-a; return a*b;" 244
+assert_folds -O0 "a=1; b=4; a=a+5; b=b-a; return a*b;" "add qword ptr [rsp-16], 5"
+assert_folds -O0 "a=1; b=4; a=a+5; b=b-a; return a*b;" "sub qword ptr [rsp-8], rsi"
+
+# Variables are not updated in memory when the added value assigns them. The last two were found
+# by random programs with assignments inside expressions.
+assert "a=1; a=a+(a=5); return a;" 6
+assert "a=0-4; b=0-4; c=7; d=7; e=2; e=e+(e=d); c=c-(((b>d)<=(3-a))==((a=5)>=(0-3))); c=c+(8*(a=(b<e))); return (d=e);" 9
+assert "a=1; b=0-4; c=0-4; d=7; e=7; c=c-((e=(0-8))<c); b=((7/(5*b))-((b<1)-(b<16))); d=d-(c=(e=(b=9))); return ((d=(e=a))*((8-((a=a)>a))*e));" 8
+
+# Frames hold exactly the locals rounded to 16 bytes, and leaf code keeps up to 128 bytes in the
+# red zone under rsp without a frame.
+assert_frame() {
+    options="$1"
+    input="$2"
+    expected="$3"
+
+    ./9cc $options "$input" > temp.s
+    actual=$(grep -m 1 "sub rsp" temp.s | sed "s/^  //")
+    if ! grep -q "push rbp" temp.s; then
+        actual="no frame"
+    fi
+    if [ "$actual" != "$expected" ]; then
+        echo "$options $input => \"$expected\" expected, but got \"$actual\""
+        cat temp.s
+        exit 1
+    fi
+    echo "$options $input => $actual"
+}
+
+names=({a..z} za zb zc zd)
+locals=""
+for i in $(seq 1 30); do
+    locals="${locals}${names[i - 1]}=$i; "
+done
+assert "${locals}return a+zd*(b+zc*(c+zb*(d+za*(e+z*(f+y)))))-q;" 102
+assert_frame -O0 "${locals}return a+zd*(b+zc*(c+zb*(d+za*e)));" "sub rsp, 240"
+assert_frame "-O0 -fstack-machine" "${locals}return a;" "sub rsp, 240"
+assert_frame -O0 "a=1; b=a*2; return a+b;" "no frame"
+assert_frame "-O0 -fstack-machine" "return 1+2*3;" "no frame"
+assert_frame "-O0 -fstack-machine" "a=1; b=a*2; return a+b;" "sub rsp, 16"
+assert_frame "-O1 -fno-const-prop" "a=1; b=a*2; return a+b;" "no frame"
+# 16 locals fit in the red zone, 17 do not, and neither do any when six values are live at once.
+assert_frame -O0 "${locals%%q=*}return a;" "no frame"
+assert_frame -O0 "${locals%%r=*}return a;" "sub rsp, 144"
+assert_frame -O0 "$balanced" "sub rsp, 64"
+assert_folds "-O1 -fno-const-prop" "$folded" "add rax, 5"
+# Variables are operands only where no other operand assigns them first.
+assert "a=1; return a+(a=5);" 6
+assert "a=1; return (a=5)+a;" 10
+assert "a=2; return a*(a=3)-a;" 3
+assert "a=2; b=3; return (b==(a=3))+a*2;" 7
+
+# Deep nesting, read from stdin because it exceeds the argument size limit.
+assert_stdin() {
+    name="$1"
+    expected="$2"
+
+    cat > temp.in
+    ./9cc --exe -o temp - < temp.in || exit 1
+    ./temp
+    actual="$?"
+    # The interpreters lower and run the tree without recursion, at the default stack size.
+    ./9cc --interp - < temp.in
+    interp="$?"
+    ./9cc --interp=switch - < temp.in
+    switch="$?"
+
+    if [ "$actual" = "$expected" ] && [ "$interp" = "$expected" ] && [ "$switch" = "$expected" ]; then
+        echo "$name => $actual"
+    else
+        echo "$name => $expected expected, but got $actual, $interp by --interp and $switch by" \
+            "--interp=switch"
+        exit 1
+    fi
+}
+
+repeat() {
+    head -c "$2" /dev/zero | tr '\0' "$1"
+}
+
+depth=1000000
+{ repeat "(" $depth; echo -n 1; repeat ")" $depth; echo ";"; } | assert_stdin "($depth nested parentheses)" 1
+{ repeat "-" $depth | sed 's/-/-(/g'; echo -n 3; repeat ")" $depth; echo ";"; } | assert_stdin "-(-(...$depth...))" 3
+{ repeat "a" $depth | sed 's/a/a=/g'; echo "7; return a;"; } | assert_stdin "a=a=...$depth...=7" 7
+
+# Peephole rules, on instructions separated by "; ", where labels end with ":". A rule of "-"
+# expects no rewrite.
+assert_peephole() {
+    rule="$1"
+    input="$2"
+    expected="$3"
+
+    IFS=";" read -ra lines <<< "$input"
+    for line in "${lines[@]}"; do
+        line="${line# }"
+        if [[ "$line" == *: ]]; then
+            echo "$line"
+        else
+            echo "  $line"
+        fi
+    done | ./9cc --stats --peephole > temp.s 2> temp.err
+    actual=$(sed "s/^  //" temp.s | paste -sd ";" | sed "s/;/; /g")
+    hits=$(grep "^peephole:" temp.err | cut -d " " -f 2 | paste -sd " ")
+
+    if [ "$actual" = "$expected" ] && [ "${hits:--}" = "$rule" ]; then
+        echo "$input => $actual by $rule"
+    else
+        echo "$input => $expected by $rule expected, but got $actual by ${hits:--}"
+        exit 1
+    fi
+}
+
+assert_peephole push-pop "push rax; pop rdi" "mov rdi, rax"
+assert_peephole push-pop "push 5; pop rdi" "mov rdi, 5"
+assert_peephole push-pop "push rax; pop rax" ""
+assert_peephole push-op-pop "push 2; mov rdi, 3; pop rax" "mov rdi, 3; mov rax, 2"
+assert_peephole - "push rax; mov rdi, rax; pop rdi" "push rax; mov rdi, rax; pop rdi"
+assert_peephole - "push rax; cqo; pop rdi" "push rax; cqo; pop rdi"
+assert_peephole - "push rax; setl al; pop rdi" "push rax; setl al; pop rdi"
+assert_peephole mov-self "mov rax, rax; ret" "ret"
+assert_peephole dead-mov "mov rax, 1; mov rax, rdi" "mov rax, rdi"
+assert_peephole - "mov rax, 1; mov rax, [rax]" "mov rax, 1; mov rax, [rax]"
+assert_peephole mov-back "mov rsi, rax; mov rax, rsi" "mov rsi, rax"
+assert_peephole address-load "mov rax, rbp; sub rax, 8; mov rax, [rax]" "mov rax, [rbp-8]"
+assert_peephole unreachable "ret; pop rax; mov rsp, rbp" "ret"
+assert_peephole - "ret; main:; pop rax" "ret; main:; pop rax"
+assert_peephole - "push rax; main:; pop rdi" "push rax; main:; pop rdi"
+assert_peephole "push-pop push-op-pop address-load" \
+    "mov rax, rbp; sub rax, 8; push rax; pop rax; mov rax, [rax]; push rax; push 5; pop rdi; pop rax" \
+    "mov rax, [rbp-8]; mov rdi, 5"
+
+# Stack machine code is mostly rewritten by the rules.
+input="a=1; b=a*2+a/3; return b-a;"
+before=$(./9cc -O0 -fstack-machine -fno-peephole "$input" | grep -c "push\|pop")
+after=$(./9cc -O0 -fstack-machine "$input" | grep -c "push\|pop")
+if [ "$after" -gt 4 ] || [ "$before" -lt 20 ]; then
+    echo "$input => 20 pushes and pops cut to 4 expected, but got $before cut to $after"
+    exit 1
+fi
+echo "$input => $before pushes and pops cut to $after"
+
+# The encoder gives the bytes of GNU as, for every form the backends emit and a few more.
+assert_encoded() {
+    name="$1"
+
+    as -o temp.o temp.s
+    objcopy -O binary -j .text temp.o temp.bin
+    ./9cc --encode < temp.s > temp.code
+    if ! cmp -s temp.bin temp.code; then
+        echo "$name => bytes of GNU as expected"
+        cmp -l temp.bin temp.code | head
+        exit 1
+    fi
+    echo "$name => $(wc -c < temp.code) bytes encoded"
+}
+
+# rsp, rbp, r12 and r13 as bases, r8-r15 and low bytes need special encodings, and the 40
+# additions put .L.far out of reach of a short jump.
+{
+    cat << EOF
+.intel_syntax noprefix
+.global main
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 240
+  sub rsp, 16
+  add rax, 100000
+  add rbx, 100000
+  sub rax, -129
+  cmp rax, 7
+  cmp r8, 1000
+  cmp rsi, qword ptr [rsp-8]
+  add r11, qword ptr [rbp-8]
+  sub r15, qword ptr [r12-200]
+  add rsi, r8
+  sub r9, r10
+  cmp rax, rdi
+  mov rax, 1
+  mov r8, -1
+  mov rax, 3000000000
+  mov r12, -3000000000
+  mov rax, rbx
+  mov r13, rsp
+  mov rsp, rbp
+  mov rax, [rbp-8]
+  mov r10, [r13]
+  mov rdi, [rbp]
+  mov rax, [rax]
+  mov rsi, [rsp]
+  mov [rbp-16], rsi
+  mov [rsp-128], r14
+  mov [rsp-136], rbx
+  mov qword ptr [rsp-24], 3
+  mov qword ptr [rbp-1024], -5
+  mov rax, qword ptr [rbp-24]
+  imul rax, rdi
+  imul r9, qword ptr [rsp-8]
+  imul rsi, qword ptr [rsp-24], 7
+  imul rax, rax, 1000
+  imul r11, r11, -3
+  imul rax, 5
+  imul rcx
+  idiv rdi
+  idiv qword ptr [rsp-16]
+  idiv r8
+  neg rax
+  neg r10
+  test rsi, rsi
+  test r11, r8
+  add qword ptr [rsp-8], 5
+  sub qword ptr [rbp-16], r9
+  cqo
+  shl rax, 3
+  shl r9, 1
+  shl rsi, cl
+  shr rax, 63
+  sar rdx, 5
+  sar rdi, 63
+  lea rax, [rax+rax*2]
+  lea r8, [r8+r8*4]
+  lea rsi, [rsi+rsi*8]
+  lea r13, [r13+r13*2]
+  lea rbp, [rbp+rbp*2]
+  lea rsp, [rsp+rbp*2]
+  lea rsi, [rsi+r8*4+8]
+  lea r9, [r10+r11*8-16]
+  lea r8, [rsi+r9]
+  sete al
+  setne al
+  setl al
+  setle al
+  setg sil
+  setge r9b
+  movzb rax, al
+  movzb rsi, al
+  movzb r11, al
+  movzb rdi, sil
+  push rax
+  push r8
+  push 5
+  push -128
+  push 1000
+  push qword ptr [rbp-8]
+  push qword ptr [rsp-16]
+  pop rdi
+  pop r15
+.L.back:
+  jmp .L.return
+  je .L.back
+  jne .L.return
+  jmp .L.back
+  jl .L.far
+  add rax, 1
+.L.return:
+  mov rsp, rbp
+  pop rbp
+  ret
+EOF
+    for i in $(seq 1 40); do
+        echo "  add rax, 1"
+    done
+    printf ".L.far:\n  jmp .L.back\n  jle .L.back\n  ret\n"
+} > temp.s
+assert_encoded "instruction forms"
+
+for input in "$balanced" "$folded" "${locals}return a+zd*(b+zc*(c+zb*(d+za*(e+z*(f+y)))))-q;" \
+    "a=1; b=2; c=3; d=4; e=5; f=6; return a*b+c*d+e*f;" \
+    "a=0-7; b=a/2+a/(0-4)+a/3+a/(0-7)+a/1; c=a*3+a*5+a*9+a*12; return b*c+3000000000/a;" \
+    "a=1; b=a<2; c=a<=b; d=a>b; e=a>=b; f=a==b; g=a!=b; return b+c+d+e+f+g;" \
+    "a=1; b=2; a=a+5; b=b-a; c=0-a+(b<0)+(0<=b)+(a==0); return a+b*4+8+c;"; do
+    for opt in $opt_levels; do
+        ./9cc ${opt//,/ } "$input" > temp.s
+        assert_encoded "$opt $input"
+    done
+done
+
+# Objects written by `-c` link with both linkers, and calls out of the code get the relocations
+# of GNU as.
+cat << EOF > temp.s
+.intel_syntax noprefix
+.global main
+main:
+  push rbx
+  mov rdi, 20
+  call helper
+  mov rbx, rax
+  call helper
+  add rax, rbx
+  pop rbx
+  ret
+EOF
+as -o temp.o temp.s
+objdump -dr temp.o | sed 1,3d > temp.out
+./9cc -c -o temp.o --encode < temp.s
+for linker in bfd gold; do
+    echo "long helper(long x) { return x + 1; }" | cc -fuse-ld=$linker -o temp temp.o -x c -
+    ./temp
+    actual="$?"
+    if [ "$actual" != 42 ] || ! objdump -dr temp.o | sed 1,3d | cmp -s - temp.out; then
+        echo "$linker: call helper => 42 and the relocations of GNU as expected, but got $actual"
+        objdump -dr temp.o
+        exit 1
+    fi
+    echo "$linker: call helper => $actual"
+done
+
+# jit_run() is a library call from the source text to the result, here of two programs with their
+# own variables run by a C program linked with the objects of the compiler. A program with more
+# errors than the limit fails without exiting, and leaves the variables of the caller alone.
+cat << EOF | cc -o temp -x c - -x none $(ls *.c | sed "s/\.c$/.o/" | grep -vx main.o)
+#include <stdio.h>
+
+#include "jit.h"
+#include "node.h"
+
+int main() {
+    LVar caller = {NULL, "x", 1, 8};
+    locals = &caller;
+    long first = 0;
+    long second = 0;
+    long third = 0;
+    bool ran = jit_run("a=2; b=a*3; return a+b;", &first);
+    bool failed = !jit_run("$(printf 'a=1+; %.0s' $(seq 25))", &third);
+    ran = ran && jit_run("za=5; return za*za-(za=1);", &second);
+    printf("%ld %ld %d %d\n", first, second, ran && failed, locals == &caller);
+    return 0;
+}
+EOF
+actual=$(./temp 2> /dev/null)
+if [ "$actual" != "8 24 1 1" ]; then
+    echo "jit_run() => 8 24 1 1 expected, but got $actual"
+    exit 1
+fi
+echo "jit_run() => $actual"
+
+# Every syntax error is reported in one pass, resynchronising at the next `;`.
+assert_errors() {
+    input="$1"
+    expected="$2"
+    shift 2
+
+    if ./9cc "$@" "$input" > temp.s 2> temp.err; then
+        echo "$input => compile error expected"
+        exit 1
+    fi
+    actual=$(grep -c "\^" temp.err)
+
+    if [ "$actual" = "$expected" ]; then
+        echo "$input => $actual errors"
+    else
+        echo "$input => $expected errors expected, but got $actual"
+        cat temp.err
+        exit 1
+    fi
+}
+
+assert_errors "1+;" 1
+assert_errors "1+; a=(2; 3 @ 4; b==c=1; return ; 5" 7
+assert_errors "1+; 2+; 3+; 4+;" 2 -ferror-limit=2
+assert_errors "1+; 2+; 3+; 4+;" 4 -ferror-limit=0
+
+# Incremental mode parses only the edited statements of each new version.
+assert_incremental() {
+    expected="$1"
+    parsed="$2"
+    generated="$3"
+    shift 3
+
+    printf '%s\0' "$@" | ./9cc -O0 --incremental 2> temp.err | tr '\0' '\n' > temp.out
+    # The assembly of the last version is after the last `.intel_syntax`.
+    awk '/^\.intel_syntax/ { n++ } { out[n] = out[n] $0 "\n" } END { printf "%s", out[n] }' temp.out > temp.s
+    ./9cc --encode --exe -o temp < temp.s || exit 1
+    ./temp
+    actual="$?"
+    actual_parsed=$(tail -n 2 temp.err | head -n 1)
+    actual_generated=$(tail -n 1 temp.err)
+
+    if [ "$actual" = "$expected" ] && [ "$actual_parsed" = "incremental: parsed $parsed statements" ] &&
+        [ "$actual_generated" = "incremental: generated $generated statements" ]; then
+        echo "$* => $actual, $actual_parsed, $actual_generated"
+    else
+        echo "$* => $expected, $parsed, $generated expected, but got $actual, $actual_parsed, $actual_generated"
+        exit 1
+    fi
+}
+
+assert_incremental 7 "1 of 3" "1 of 3" "a=1; b=2; return a+b;" "a=1; b=6; return a+b;"
+assert_incremental 6 "2 of 4" "2 of 4" "a=1; b=5; return a+b;" "a=1; b=5; c=a*b; return c+a;"
+assert_incremental 4 "2 of 3" "2 of 3" "a=1; b=5; return a+b;" "a=1; b=5 return a+b;" "a=1; b=3; return a+b;"
+assert_incremental 9 "1 of 1" "1 of 1" "abc=1; return abc;" "x=9; return x;" "return 9;"
+# The code of every statement addresses the variables from the new frame of the 17th variable,
+# and the statement before the new last one no longer returns.
+assert_incremental 1 "1 of 18" "18 of 18" "${locals%%q=*}return a;" "${locals%%r=*}return a;"
+assert_incremental 3 "1 of 3" "2 of 3" "a=1; b=2;" "a=1; b=2; return a+b;"
+# Other levels compile the whole program of each version.
+printf '%s\0' "a=1; b=2; return a+b;" "a=1; b=6; return a+b;" | ./9cc -O1 --incremental 2> /dev/null > temp.out
+if [ "$(grep -c "mov rax, [37]$" temp.out)" != 2 ]; then
+    echo "-O1 --incremental => mov rax, 3 and mov rax, 7 expected"
+    cat temp.out
+    exit 1
+fi
+echo "-O1 --incremental => mov rax, 3 and mov rax, 7"
+
+# Diagnostics show `file:line:col` and only the offending line.
+assert_diagnostic() {
+    input="$1"
+    expected="$2"
+
+    ./9cc "$input" > /dev/null 2> temp.err
+    actual=$(head -n 1 temp.err)
+
+    if [ "$actual" = "$expected" ]; then
+        echo "$input => $actual"
+    else
+        echo "$input => $expected expected, but got $actual"
+        exit 1
+    fi
+}
+
+assert_diagnostic "1+;" "<input>:1:3: not number"
+assert_diagnostic $'a=1;\nb=2+;\n  c=3;' "<input>:2:5: not number"
+assert_diagnostic $'a=1;\n\n  c=(3;' "<input>:3:7: expected ')'"
+assert_diagnostic $'a=1;\nb = 2 @ 1;\nc;' "<input>:2:7: cannot tokenize"
+
+# An error in a huge one-line input prints a bounded amount.
+{ repeat "(" $depth; echo -n 1; repeat ")" $((depth - 1)); echo ";"; } | ./9cc - > /dev/null 2> temp.err
+if [ "$(head -n 1 temp.err)" != "<stdin>:1:2000001: expected ')'" ] || [ "$(wc -c < temp.err)" -gt 1000 ]; then
+    echo "huge input diagnostic => short diagnostic expected, but got $(wc -c < temp.err) bytes"
+    exit 1
+fi
+echo "huge input diagnostic => $(wc -c < temp.err) bytes"
+
+# AST files load back to the same program without parsing.
+assert_ast() {
+    input="$1"
+    expected="$2"
+
+    ./9cc --emit-ast=temp.ast "$input" || exit 1
+    ./9cc --load-ast=temp.ast --exe -o temp || exit 1
+    ./temp
+    actual="$?"
+
+    if [ "$actual" = "$expected" ]; then
+        echo "$input => ast => $actual"
+    else
+        echo "$input => ast => $expected expected, but got $actual"
+        exit 1
+    fi
+}
+
+assert_ast "abc=10; b=abc*(2+3); return b-abc;" 40
+assert_ast "a=b=c=2; return -a+b*c/2 == 0;" 1
+assert_ast "return (1+1)*2 >= 4;" 1
+
+printf 'x' | dd of=temp.ast bs=1 seek=70 conv=notrunc 2> /dev/null
+if ./9cc --load-ast=temp.ast > /dev/null 2>&1; then
+    echo "corrupted AST file => error expected"
+    exit 1
+fi
+echo "corrupted AST file => error"
+
+# AST files with a valid checksum still only load trees as program() makes them. They are written
+# here by a C program linked with the objects of the compiler.
+cat << EOF | cc -o temp -x c - -x none $(ls *.c | sed "s/\.c$/.o/" | grep -vx main.o)
+#include <stdio.h>
+
+#include "serialize.h"
+
+/* Writes a program of one variable at offset, and of the statement rooted at the last node. */
+void write_nodes(char* path, AstNode* nodes, uint32_t count, int32_t offset) {
+    uint32_t statements[2] = {count - 1, 0};
+    AstLVar lvar = {0, 1, offset, 0};
+    char names[2] = "a";
+    AstHeader header = {AST_MAGIC, AST_VERSION, count, 1, 1, sizeof(names)};
+    header.checksum = fnv1a(14695981039346656037ull, nodes, count * sizeof(AstNode));
+    header.checksum = fnv1a(header.checksum, statements, sizeof(statements));
+    header.checksum = fnv1a(header.checksum, &lvar, sizeof(lvar));
+    header.checksum = fnv1a(header.checksum, names, sizeof(names));
+
+    FILE* out = fopen(path, "wb");
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(nodes, sizeof(AstNode), count, out);
+    fwrite(statements, sizeof(statements), 1, out);
+    fwrite(&lvar, sizeof(lvar), 1, out);
+    fwrite(names, sizeof(names), 1, out);
+    fclose(out);
+}
+
+int main() {
+    AstNode assign[] = {{ND_LVAR, -1, -1, 0}, {ND_NUM, -1, -1, -1, 7}, {ND_ASSIGN, 0, 1, -1}};
+    write_nodes("temp.ast", assign, 3, 8);
+    write_nodes("temp.offset.ast", assign, 3, 12);
+    AstNode to_num[] = {{ND_NUM, -1, -1, -1, 1}, {ND_NUM, -1, -1, -1, 7}, {ND_ASSIGN, 0, 1, -1}};
+    write_nodes("temp.assign.ast", to_num, 3, 8);
+    AstNode inner_return[] = {{ND_NUM, -1, -1, -1, 1}, {ND_RETURN, 0, -1, -1},
+                              {ND_NUM, -1, -1, -1, 2}, {ND_ADD, 1, 2, -1}};
+    write_nodes("temp.return.ast", inner_return, 4, 8);
+    AstNode shared[] = {{ND_NUM, -1, -1, -1, 1}, {ND_ADD, 0, 0, -1}};
+    write_nodes("temp.shared.ast", shared, 2, 8);
+    return 0;
+}
+EOF
+./temp
+./9cc --load-ast=temp.ast --interp
+actual="$?"
+if [ "$actual" != 7 ]; then
+    echo "written AST file => 7 expected, but got $actual"
+    exit 1
+fi
+for malformed in offset assign return shared; do
+    if ./9cc --load-ast=temp.$malformed.ast > /dev/null 2>&1; then
+        echo "AST file with bad $malformed => error expected"
+        exit 1
+    fi
+    echo "AST file with bad $malformed => error"
+done
+
 echo "Test end"
@@ -19,30 +19,38 @@ bool consume_op(Token** token, char* op) {
 }
 
 /* Ensure the current token is `op` and move to the next token. */
-void expect_op(char* user_input, Token** token, char* op) {
+/* Otherwise reports an error and returns false without moving. */
+bool expect_op(char* user_input, Token** token, char* op) {
     if ((*token)->kind != TK_RESERVED || (*token)->len != strlen(op) ||
         memcmp((*token)->str, op, (*token)->len)) {
-        error_at(user_input, (*token)->str, "expected '%c'", op);
+        error_at(user_input, (*token)->str, "expected '%s'", op);
+        return false;
     }
     (*token) = (*token)->next;
+    return true;
 }
 
-/* Ensure the current token is number and move to the next token then returns the number. */
-int expect_number(char* user_input, Token** token) {
+/* Ensure the current token is number and move to the next token then stores the number. */
+/* Otherwise reports an error and returns false without moving. */
+bool expect_number(char* user_input, Token** token, long* val) {
     if ((*token)->kind != TK_NUM) {
         error_at(user_input, (*token)->str, "not number");
+        return false;
     }
-    int val = (*token)->val;
+    *val = (*token)->val;
     *token = (*token)->next;
-    return val;
+    return true;
 }
 
 /* Ensure the current token is lvalue, and move to the next token. */
-void expect_lvar(char* user_input, Token** token) {
+/* Otherwise reports an error and returns false without moving. */
+bool expect_lvar(char* user_input, Token** token) {
     if ((*token)->kind != TK_IDENT) {
         error_at(user_input, (*token)->str, "expected lvalue");
+        return false;
     }
     *token = (*token)->next;
+    return true;
 }
 
 bool at_eof(Token* token) { return token->kind == TK_EOF; }
@@ -65,14 +73,25 @@ bool is_alphabet_or_number(char c) {
 }
 
 /* Tokenize `user_input` and returns token linked list. */
+/* Lines are indexed on the way for diagnostics. */
 Token* tokenize(char* user_input) {
-    char* p = user_input;
+    start_line_index(user_input);
+    return tokenize_range(user_input, user_input, user_input + strlen(user_input));
+}
+
+/* Tokenize `user_input` from `begin` to `end`, which must be on token boundaries. */
+/* The TK_EOF token is located at `end`. */
+Token* tokenize_range(char* user_input, char* begin, char* end) {
+    char* p = begin;
     Token head;
     head.next = NULL;
     Token* current = &head;
 
-    while (*p) {
+    while (p < end) {
         if (isspace(*p)) {
+            if (*p == '\n') {
+                add_line_start(user_input, p + 1);
+            }
             p++;
             continue;
         }
@@ -103,7 +122,9 @@ Token* tokenize(char* user_input) {
             continue;
         }
 
+        /* Skip the character so that the rest of the input is still checked. */
         error_at(user_input, p, "cannot tokenize");
+        p++;
     }
 
     create_token(TK_EOF, current, p, 0);
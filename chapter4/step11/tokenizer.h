@@ -13,18 +13,18 @@ typedef struct Token Token;
 struct Token {
     TokenKind kind;
     Token* next;
-    int val;   // TK_NUM value.
+    long val;  // TK_NUM value.
     char* str; // TK_IDENT name.
     int len;   // TK_IDENT name length.
 };
 
 bool consume_op(Token** token, char* op);
 
-void expect_op(char* user_input, Token** token, char* op);
+bool expect_op(char* user_input, Token** token, char* op);
 
-int expect_number(char* user_input, Token** token);
+bool expect_number(char* user_input, Token** token, long* val);
 
-void expect_lvar(char* user_input, Token** token);
+bool expect_lvar(char* user_input, Token** token);
 
 bool at_eof(Token* token);
 
@@ -34,4 +34,6 @@ bool multiletter_op(char* op, char* p);
 
 Token* tokenize(char* user_input);
 
+Token* tokenize_range(char* user_input, char* begin, char* end);
+
 #endif // !TOKENIZER_H
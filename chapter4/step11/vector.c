@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "vector.h"
+
+Vector* create_vector() {
+    Vector* vec = calloc(1, sizeof(Vector));
+    vec->capacity = 16;
+    vec->data = calloc(vec->capacity, sizeof(void*));
+    return vec;
+}
+
+void vec_push(Vector* vec, void* elem) {
+    if (vec->len == vec->capacity) {
+        /* Double the capacity so that pushes are amortized O(1). */
+        vec->capacity *= 2;
+        vec->data = realloc(vec->data, sizeof(void*) * vec->capacity);
+        if (!vec->data) {
+            error("out of memory.");
+        }
+    }
+    vec->data[vec->len++] = elem;
+}
+
+void* vec_pop(Vector* vec) {
+    if (vec->len == 0) {
+        error("pop from empty vector.");
+    }
+    return vec->data[--vec->len];
+}
+
+void* vec_last(Vector* vec) {
+    if (vec->len == 0) {
+        return NULL;
+    }
+    return vec->data[vec->len - 1];
+}
+
+void buf_append(Buffer* buf, void* data, uint64_t size) {
+    if (buf->len + size > buf->capacity) {
+        buf->capacity = (buf->len + size) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+        if (!buf->data) {
+            error("out of memory.");
+        }
+    }
+    memcpy(buf->data + buf->len, data, size);
+    buf->len += size;
+}
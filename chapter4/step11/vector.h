@@ -0,0 +1,31 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stdint.h>
+
+/* Growable array of pointers, used where recursion or fixed arrays would limit input size. */
+typedef struct Vector Vector;
+struct Vector {
+    void** data;
+    int capacity;
+    int len;
+};
+
+Vector* create_vector();
+
+void vec_push(Vector* vec, void* elem);
+
+void* vec_pop(Vector* vec);
+
+void* vec_last(Vector* vec);
+
+/* Growable array of bytes, such as a section of a file being written. */
+typedef struct {
+    char* data;
+    uint64_t len;
+    uint64_t capacity;
+} Buffer;
+
+void buf_append(Buffer* buf, void* data, uint64_t size);
+
+#endif // !VECTOR_H
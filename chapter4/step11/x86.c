@@ -0,0 +1,315 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "error.h"
+#include "insn.h"
+#include "ir.h"
+#include "regalloc.h"
+#include "x86.h"
+
+/*
+ * x86-64 code generation from the IR.
+ *
+ * Virtual registers live in the physical registers chosen by the register allocator, or in
+ * stack slots below the local variables when they are spilled. Instructions load `lhs` to rax,
+ * compute in rax with `rhs` as an immediate or from its place, and move rax to the place of `dst`,
+ * except `add`, `sub`, `imul` and operations by constants computed in place when `dst` and `lhs`
+ * share a register. rcx, rdx and rdi are scratch for shifts and division.
+ *
+ * Frame, from frame_reg down, which is rsp when it fits in the red zone since the code is leaf:
+ *
+ *   local variables      [rbp-8] .. [rbp-locals_size]
+ *   spill slots          then 8 bytes each
+ *   callee-saved         the allocatable registers used, saved by the prologue
+ */
+
+/* Allocatable registers, which the ABI says are callee-saved. */
+char* alloc_regs[ALLOC_REG_COUNT] = {"rbx", "r12", "r13", "r14", "r15"};
+
+/* Returns the operand text of the place of each virtual register, rax for the `returned` ones. */
+char** reg_places(Allocation* alloc, int reg_count, int locals_size, bool* returned) {
+    char** places = calloc(reg_count + 1, sizeof(char*));
+    for (int reg = 1; reg <= reg_count; reg++) {
+        if (returned[reg]) {
+            places[reg] = "rax";
+        } else if (alloc->regs[reg] >= 0) {
+            places[reg] = alloc_regs[alloc->regs[reg]];
+        } else if (alloc->slots[reg]) {
+            places[reg] = calloc(1, 32);
+            sprintf(places[reg], "qword ptr [%s-%d]", frame_reg,
+                    locals_size + alloc->slots[reg] * 8);
+        }
+    }
+    return places;
+}
+
+void count_use(int reg, void* uses) { ((int*)uses)[reg]++; }
+
+/* Returns the registers whose only use is the return right after their definition, which are
+ * computed in rax where the return wants them. */
+bool* returned_regs(IrProgram* prog) {
+    int* uses = calloc(prog->reg_count + 1, sizeof(int));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            for_each_use(block->irs->data[j], count_use, uses);
+        }
+    }
+
+    bool* returned = calloc(prog->reg_count + 1, sizeof(bool));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j + 1 < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            Ir* next = block->irs->data[j + 1];
+            if (ir->dst && ir->kind != IR_PHI && next->kind == IR_RET && next->lhs == ir->dst &&
+                uses[ir->dst] == 1) {
+                returned[ir->dst] = true;
+            }
+        }
+    }
+    free(uses);
+    return returned;
+}
+
+/* Offset of the slot saving the allocatable register `index`, which follows the slots of the used
+ * registers before it. */
+int save_offset(Allocation* alloc, int locals_size, int index) {
+    int saved = 0;
+    for (int i = 0; i <= index; i++) {
+        saved += (alloc->used >> i) & 1;
+    }
+    return locals_size + (alloc->slot_count + saved) * 8;
+}
+
+void generate_epilogue(Allocation* alloc, int locals_size, bool frame) {
+    for (int i = 0; i < ALLOC_REG_COUNT; i++) {
+        if (alloc->used & 1 << i) {
+            emit("  mov %s, [%s-%d]\n", alloc_regs[i], frame_reg,
+                 save_offset(alloc, locals_size, i));
+        }
+    }
+    generate_frame_epilogue(frame);
+}
+
+/* Mnemonic of `op` computed in place as `dst = dst op src`, or NULL if only rax is used. */
+char* two_address_op(NodeKind op) {
+    switch (op) {
+    case ND_ADD:
+        return "add";
+    case ND_SUB:
+        return "sub";
+    case ND_MUL:
+        return "imul";
+    default:
+        return NULL;
+    }
+}
+
+/* Returns true if `ir` takes the constant `imm` as its operand `reg` without a register. */
+bool folds_imm(Ir* ir, int reg, Ir* imm) {
+    bool imm32 = imm->val == (int)imm->val;
+    if (ir->kind == IR_STORE) {
+        return imm32;
+    }
+    /* `mov rax` takes any immediate. */
+    if (ir->kind == IR_RET) {
+        return true;
+    }
+    if (ir->kind != IR_BIN || reg != ir->rhs || reg == ir->lhs) {
+        return false;
+    }
+    return by_constant(ir->op, imm->val) || (imm32 && ir->op != ND_DIV);
+}
+
+/* Returns whether each register is read from its place, that is not only as an immediate. */
+bool* read_regs(IrProgram* prog, Ir** defs) {
+    bool* read = calloc(prog->reg_count + 1, sizeof(bool));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            int uses[] = {ir->lhs, ir->rhs};
+            for (int k = 0; k < 2; k++) {
+                int reg = uses[k];
+                if (reg && (defs[reg]->kind != IR_IMM || !folds_imm(ir, reg, defs[reg]))) {
+                    read[reg] = true;
+                }
+            }
+        }
+    }
+    return read;
+}
+
+/* Moves the value returned by `ir` to rax, unless it is computed there. */
+void generate_return_value(Ir* ir, Ir** defs, char** places) {
+    Ir* val = defs[ir->lhs];
+    if (val->kind == IR_IMM) {
+        emit("  mov rax, %ld\n", val->val);
+    } else if (strcmp(places[ir->lhs], "rax") != 0) {
+        emit("  mov rax, %s\n", places[ir->lhs]);
+    }
+}
+
+void generate_ir(Ir* ir, Ir** defs, char** places, Allocation* alloc) {
+    switch (ir->kind) {
+    case IR_IMM:
+        /* Only `mov` to a register takes a 64 bit immediate. */
+        if (alloc->regs[ir->dst] >= 0 || ir->val == (int)ir->val) {
+            emit("  mov %s, %ld\n", places[ir->dst], ir->val);
+            return;
+        }
+        emit("  mov rax, %ld\n", ir->val);
+        break;
+    case IR_LOAD:
+        emit("  mov rax, [%s-%d]\n", frame_reg, ir->lvar->offset);
+        break;
+    case IR_STORE: {
+        /* Memory takes a 32 bit immediate or a register, but not another memory operand. */
+        Ir* val = defs[ir->lhs];
+        if (val->kind == IR_IMM && val->val == (int)val->val) {
+            emit("  mov qword ptr [%s-%d], %ld\n", frame_reg, ir->lvar->offset, val->val);
+            return;
+        }
+        if (alloc->regs[ir->lhs] >= 0) {
+            emit("  mov [%s-%d], %s\n", frame_reg, ir->lvar->offset, places[ir->lhs]);
+            return;
+        }
+        emit("  mov rax, %s\n", places[ir->lhs]);
+        emit("  mov [%s-%d], rax\n", frame_reg, ir->lvar->offset);
+        return;
+    }
+    case IR_BIN: {
+        Ir* rhs = defs[ir->rhs];
+        /* The allocator coalesces `dst` with `lhs` to leave rax out. */
+        int reg = alloc->regs[ir->dst];
+        bool in_place = reg >= 0 && reg == alloc->regs[ir->lhs];
+        if (rhs->kind == IR_IMM && by_constant(ir->op, rhs->val)) {
+            if (in_place) {
+                generate_by_constant(ir->op, places[ir->dst], rhs->val);
+                return;
+            }
+            emit("  mov rax, %s\n", places[ir->lhs]);
+            generate_by_constant(ir->op, "rax", rhs->val);
+            break;
+        }
+        /* Instructions take a 32 bit immediate, but `idiv`, or a spill slot as `rhs`. */
+        char* src = places[ir->rhs];
+        if (rhs->kind == IR_IMM && rhs->val == (int)rhs->val && ir->op != ND_DIV) {
+            src = calloc(1, 32);
+            sprintf(src, "%ld", rhs->val);
+        }
+        if (two_address_op(ir->op) && in_place) {
+            emit("  %s %s, %s\n", two_address_op(ir->op), places[ir->dst], src);
+            return;
+        }
+        emit("  mov rax, %s\n", places[ir->lhs]);
+        generate_binary(ir->op, "rax", src);
+        break;
+    }
+    case IR_PHI:
+        error("phi is not supported by the backend.");
+        return;
+    case IR_RET:
+        generate_return_value(ir, defs, places);
+        generate_return();
+        return;
+    }
+    if (strcmp(places[ir->dst], "rax") != 0) {
+        emit("  mov %s, rax\n", places[ir->dst]);
+    }
+}
+
+/* Returns the instruction defining each register, to find constant operands. */
+Ir** reg_defs(IrProgram* prog) {
+    Ir** defs = calloc(prog->reg_count + 1, sizeof(Ir*));
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            if (ir->dst) {
+                defs[ir->dst] = ir;
+            }
+        }
+    }
+    return defs;
+}
+
+/*
+ * Returns the registers that the allocator gives no place: constants only used as immediates,
+ * which are never emitted, and values computed in rax for the return right after them. No
+ * callee-saved register is then saved only to hold them.
+ */
+bool* unplaced_regs(IrProgram* prog) {
+    Ir** defs = reg_defs(prog);
+    bool* read = read_regs(prog, defs);
+    bool* unplaced = returned_regs(prog);
+    for (int reg = 1; reg <= prog->reg_count; reg++) {
+        if (defs[reg] && defs[reg]->kind == IR_IMM && !read[reg]) {
+            unplaced[reg] = true;
+        }
+    }
+    free(read);
+    free(defs);
+    return unplaced;
+}
+
+/* Prints the whole assembly of `prog`, with virtual registers placed by `alloc`. */
+void generate_ir_program(IrProgram* prog, Allocation* alloc) {
+    Ir** defs = reg_defs(prog);
+    int locals_size = 0;
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            if (ir->lvar && ir->lvar->offset > locals_size) {
+                locals_size = ir->lvar->offset;
+            }
+        }
+    }
+    /* The code is leaf, as it neither pushes nor calls. */
+    generate_header();
+    bool frame = generate_prologue(save_offset(alloc, locals_size, ALLOC_REG_COUNT - 1), true);
+    shared_epilogue = frame || alloc->used;
+    return_jumped = false;
+    for (int i = 0; i < ALLOC_REG_COUNT; i++) {
+        if (alloc->used & 1 << i) {
+            emit("  mov [%s-%d], %s\n", frame_reg, save_offset(alloc, locals_size, i),
+                 alloc_regs[i]);
+        }
+    }
+    bool* returned = returned_regs(prog);
+    char** places = reg_places(alloc, prog->reg_count, locals_size, returned);
+    bool* read = read_regs(prog, defs);
+
+    /* Blocks are laid out in order, and every block ends with a return for now. */
+    for (int i = 0; i < prog->blocks->len; i++) {
+        Block* block = prog->blocks->data[i];
+        for (int j = 0; j < block->irs->len; j++) {
+            Ir* ir = block->irs->data[j];
+            /* Constants only used as immediates need no register. */
+            if (ir->kind == IR_IMM && !read[ir->dst]) {
+                continue;
+            }
+            /* The last return runs into the shared epilogue. */
+            bool last = i == prog->blocks->len - 1 && j == block->irs->len - 1;
+            if (last && ir->kind == IR_RET && shared_epilogue) {
+                generate_return_value(ir, defs, places);
+                continue;
+            }
+            generate_ir(ir, defs, places, alloc);
+        }
+    }
+    if (shared_epilogue) {
+        if (return_jumped) {
+            emit(RETURN_LABEL ":\n");
+        }
+        generate_epilogue(alloc, locals_size, frame);
+    }
+    free(returned);
+    free(read);
+    free(defs);
+}
@@ -0,0 +1,27 @@
+#ifndef X86_H
+#define X86_H
+
+#include "ir.h"
+#include "regalloc.h"
+
+char** reg_places(Allocation* alloc, int reg_count, int locals_size, bool* returned);
+
+bool* returned_regs(IrProgram* prog);
+
+int save_offset(Allocation* alloc, int locals_size, int index);
+
+void generate_epilogue(Allocation* alloc, int locals_size, bool frame);
+
+char* two_address_op(NodeKind op);
+
+void generate_return_value(Ir* ir, Ir** defs, char** places);
+
+void generate_ir(Ir* ir, Ir** defs, char** places, Allocation* alloc);
+
+Ir** reg_defs(IrProgram* prog);
+
+bool* unplaced_regs(IrProgram* prog);
+
+void generate_ir_program(IrProgram* prog, Allocation* alloc);
+
+#endif // !X86_H